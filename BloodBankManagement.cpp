@@ -8,6 +8,45 @@
 #include <ctime>
 #include <cctype>
 #include <map>
+#include <set>
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+#include <cstring>
+#include <cerrno>
+#include <filesystem>
+#include <string_view>
+#include <charconv>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <iterator>
+#include <functional>
+#include <deque>
+#include <shared_mutex>
+#include <unordered_set>
+#include <bitset>
+#include <tuple>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
 
 using namespace std;
 
@@ -15,11 +54,175 @@ using namespace std;
 const string USERS_FILE = "users.txt";
 const string BLOOD_FILE = "blood_inventory.txt";
 const string REQUESTS_FILE = "blood_requests.txt";
+const string REQUESTS_ARCHIVE_FILE = "blood_requests_archive.txt";
+const string REQUESTS_ARCHIVE_SUMMARY_FILE = "blood_requests_archive.idx";
 const string ACTIVITY_LOG_FILE = "activity_log.txt";
+const string ACTIVITY_LOG_INDEX_FILE = "activity_log.idx";
 const string REQUEST_ID_FILE = "last_request_id.txt";
+const string BLOOD_JOURNAL_FILE = "blood_inventory.journal";
+const string REQUESTS_JOURNAL_FILE = "blood_requests.journal";
+const string USERS_SNAPSHOT_FILE = "users.bin";
+const string BLOOD_SNAPSHOT_FILE = "blood_inventory.bin";
+const string REQUESTS_SNAPSHOT_FILE = "blood_requests.bin";
+const string METRICS_FILE = "metrics.txt";
+
+const int JOURNAL_CHECKPOINT_THRESHOLD = 500;
+// Dirty tables are written together by the commit thread on this
+// interval, or sooner once this many changes have queued up.
+const chrono::milliseconds GROUP_COMMIT_INTERVAL(1000);
+const int GROUP_COMMIT_THRESHOLD = 64;
+const size_t FILE_WRITE_BUFFER = 256 << 10;
+const size_t INVENTORY_COMPACTION_MIN = 256;
+// Days a donated unit stays usable. The inventory holds a single product,
+// whole blood, so one rule covers every unit.
+const int32_t SHELF_LIFE_DAYS = 42;
+// Table files are parsed in chunks of at least this size, one per thread.
+const size_t PARALLEL_LOAD_CHUNK = 1 << 20;
+
+// Activity log segments rotate at this size or day span.
+const uint64_t LOG_SEGMENT_MAX_BYTES = 64ull << 20;
+const int32_t LOG_SEGMENT_MAX_DAYS = 7;
+const bool COMPRESS_CLOSED_LOG_SEGMENTS = true;
+const size_t LOG_COMPRESSION_BLOCK = 256 << 10;
+const size_t LOG_WRITE_BUFFER = 64 << 10;
+
+const uint16_t DEFAULT_SERVER_PORT = 5050;
+const size_t DEFAULT_SERVER_WORKERS = 8;
 
 const vector<string> VALID_BLOOD_TYPES = {"A+", "A-", "B+", "B-", "AB+", "AB-", "O+", "O-"};
+const size_t BLOOD_TYPE_COUNT = 8;
+
+enum class BloodType : uint8_t { APos, ANeg, BPos, BNeg, ABPos, ABNeg, OPos, ONeg, Invalid = 0xFF };
+
+// Red cell antigens carried by each type, indexed like VALID_BLOOD_TYPES.
+constexpr uint8_t ANTIGEN_A = 1, ANTIGEN_B = 2, ANTIGEN_RH = 4;
+constexpr array<uint8_t, BLOOD_TYPE_COUNT> BLOOD_ANTIGENS = {
+    ANTIGEN_A | ANTIGEN_RH, ANTIGEN_A, ANTIGEN_B | ANTIGEN_RH, ANTIGEN_B,
+    ANTIGEN_A | ANTIGEN_B | ANTIGEN_RH, ANTIGEN_A | ANTIGEN_B, ANTIGEN_RH, 0
+};
+
+// COMPATIBLE_DONORS[recipient] has bit d set when type d can be given to
+// the recipient, i.e. the donor carries no antigen the recipient lacks.
+constexpr array<uint8_t, BLOOD_TYPE_COUNT> buildCompatibilityTable() {
+    array<uint8_t, BLOOD_TYPE_COUNT> table{};
+    for (size_t r = 0; r < BLOOD_TYPE_COUNT; ++r) {
+        for (size_t d = 0; d < BLOOD_TYPE_COUNT; ++d) {
+            if ((BLOOD_ANTIGENS[d] & ~BLOOD_ANTIGENS[r]) == 0) table[r] |= uint8_t(1u << d);
+        }
+    }
+    return table;
+}
+
+constexpr array<uint8_t, BLOOD_TYPE_COUNT> COMPATIBLE_DONORS = buildCompatibilityTable();
+
+// Per recipient, the compatible donor types in the order stock should be
+// drawn: the exact type first, then types that can serve the fewest other
+// recipients, Rh-positive before Rh-negative, so O- goes last. Unused
+// entries are 0xFF.
+constexpr array<array<uint8_t, BLOOD_TYPE_COUNT>, BLOOD_TYPE_COUNT> buildSubstitutionOrder() {
+    array<int, BLOOD_TYPE_COUNT> recipientsServed{};
+    for (size_t r = 0; r < BLOOD_TYPE_COUNT; ++r) {
+        for (size_t d = 0; d < BLOOD_TYPE_COUNT; ++d) {
+            if (COMPATIBLE_DONORS[r] & (1u << d)) recipientsServed[d]++;
+        }
+    }
+    array<array<uint8_t, BLOOD_TYPE_COUNT>, BLOOD_TYPE_COUNT> order{};
+    for (size_t r = 0; r < BLOOD_TYPE_COUNT; ++r) {
+        size_t count = 0;
+        order[r][count++] = uint8_t(r);
+        for (size_t d = 0; d < BLOOD_TYPE_COUNT; ++d) {
+            if (d == r || !(COMPATIBLE_DONORS[r] & (1u << d))) continue;
+            size_t i = count++;
+            int key = recipientsServed[d] * 2 + ((BLOOD_ANTIGENS[d] & ANTIGEN_RH) ? 0 : 1);
+            while (i > 1) {
+                uint8_t prev = order[r][i - 1];
+                int prevKey = recipientsServed[prev] * 2 + ((BLOOD_ANTIGENS[prev] & ANTIGEN_RH) ? 0 : 1);
+                if (prevKey <= key) break;
+                order[r][i] = prev;
+                --i;
+            }
+            order[r][i] = uint8_t(d);
+        }
+        for (size_t i = count; i < BLOOD_TYPE_COUNT; ++i) order[r][i] = 0xFF;
+    }
+    return order;
+}
+
+constexpr array<array<uint8_t, BLOOD_TYPE_COUNT>, BLOOD_TYPE_COUNT> SUBSTITUTION_ORDER = buildSubstitutionOrder();
+
+static_assert(COMPATIBLE_DONORS[size_t(BloodType::ABPos)] == 0xFF, "AB+ is the universal recipient");
+static_assert(COMPATIBLE_DONORS[size_t(BloodType::ONeg)] == (1u << size_t(BloodType::ONeg)), "O- only receives O-");
+static_assert(SUBSTITUTION_ORDER[size_t(BloodType::APos)][3] == uint8_t(BloodType::ONeg), "O- is drawn last");
+
+const int32_t INVALID_DAY = INT32_MIN;
+
+enum class OperationResult { Ok, NotFound, NotPending, InsufficientStock, InvalidInput, NotDonor, AlreadyExists };
+
+struct BloodAllocation {
+    uint32_t unitID;
+    BloodType type;
+    int32_t donationDay;
+    int quantity;
+};
+
+struct BulkApprovalReport {
+    vector<pair<string, int>> approved;
+    vector<pair<string, int>> shortfalls;
+};
+
+// Filters for inventory and request listings. Empty strings, Invalid
+// types and the default day bounds match everything. Results come back
+// newest first, limit rows at a time starting after offset matches.
+const size_t DEFAULT_PAGE_SIZE = 20;
+struct InventoryQuery {
+    BloodType type = BloodType::Invalid;
+    int32_t fromDay = INT32_MIN;
+    int32_t toDay = INT32_MAX;
+    string donorName;
+    bool inStockOnly = false;
+    size_t offset = 0;
+    size_t limit = DEFAULT_PAGE_SIZE;
+};
+
+struct RequestQuery {
+    string status;
+    string requestorID;
+    BloodType type = BloodType::Invalid;
+    int32_t fromDay = INT32_MIN;
+    int32_t toDay = INT32_MAX;
+    size_t offset = 0;
+    size_t limit = DEFAULT_PAGE_SIZE;
+};
+
+// Per-connection state for server mode.
+struct ClientSession {
+    string userID;
+    bool closeRequested = false;
+    bool shutdownRequested = false;
+};
+
+struct QueryPage {
+    vector<size_t> rows;
+    bool more = false;
+};
+
+// A request query row: (request day, request number, row). Same-day rows
+// order by request ID whether they live in the table or the archive.
+using RequestRow = tuple<int32_t, int, size_t>;
+
+const size_t DEFAULT_LOG_TAIL = 50;
+struct LogQuery {
+    int32_t fromDay = INT32_MIN;
+    int32_t toDay = INT32_MAX;
+    string userID;
+    string keyword;
+    size_t limit = DEFAULT_LOG_TAIL;
+};
 const vector<string> VALID_ROLES = {"Admin", "Donor", "Requestor"};
+const vector<string> REQUEST_STATUSES = {"Pending", "Approved", "Rejected"};
+
+// Indexed like VALID_ROLES.
+enum class UserRole : uint8_t { Admin, Donor, Requestor, Invalid = 0xFF };
 
 
 class Utility {
@@ -32,262 +235,3492 @@ public:
     }
 
 
-    static string trim(const string& s) {
-        size_t start = s.find_first_not_of(" \t\r\n");
-        if (start == string::npos) return "";
-        size_t end = s.find_last_not_of(" \t\r\n");
-        return s.substr(start, end - start + 1);
+    static string trim(const string& s) {
+        size_t start = s.find_first_not_of(" \t\r\n");
+        if (start == string::npos) return "";
+        size_t end = s.find_last_not_of(" \t\r\n");
+        return s.substr(start, end - start + 1);
+    }
+
+
+    static bool parseDate(string_view date, int& year, int& month, int& day) {
+        if (date.size() != 10) return false;
+        if (date[4] != '-' || date[7] != '-') return false;
+        if (!parseInt(date.substr(0,4), year)) return false;
+        if (!parseInt(date.substr(5,2), month)) return false;
+        if (!parseInt(date.substr(8,2), day)) return false;
+
+        if (year < 1900 || year > 2100) return false;
+        if (month < 1 || month > 12) return false;
+
+
+        int daysInMonth[] = {31,28,31,30,31,30,31,31,30,31,30,31};
+        if ((year%4==0 && year%100!=0) || (year%400==0)) daysInMonth[1] = 29;
+
+        if (day < 1 || day > daysInMonth[month-1]) return false;
+        return true;
+    }
+
+
+    static bool isValidDate(const string& date) {
+        int year, month, day;
+        return parseDate(date, year, month, day);
+    }
+
+
+    // Days since 1970-01-01 for a YYYY-MM-DD string, or INVALID_DAY.
+    static int32_t toDayNumber(string_view date) {
+        int y, month, day;
+        if (!parseDate(date, y, month, day)) return INVALID_DAY;
+        unsigned m = unsigned(month);
+        unsigned d = unsigned(day);
+        y -= m <= 2;
+        int era = (y >= 0 ? y : y - 399) / 400;
+        unsigned yoe = unsigned(y - era * 400);
+        unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+        unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return era * 146097 + int32_t(doe) - 719468;
+    }
+
+
+    static string fromDayNumber(int32_t day) {
+        if (day == INVALID_DAY) return "";
+        day += 719468;
+        int era = (day >= 0 ? day : day - 146096) / 146097;
+        unsigned doe = unsigned(day - era * 146097);
+        unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        unsigned mp = (5 * doy + 2) / 153;
+        unsigned d = doy - (153 * mp + 2) / 5 + 1;
+        unsigned m = mp < 10 ? mp + 3 : mp - 9;
+        int y = int(yoe) + era * 400 + (m <= 2);
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%04d-%02u-%02u", y, m, d);
+        return string(buf);
+    }
+
+
+    static void pause() {
+        cout << "Press Enter to continue...";
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    }
+
+
+    static bool isNumeric(const string& s) {
+        return !s.empty() && all_of(s.begin(), s.end(), ::isdigit);
+    }
+
+
+    // Parses an unsigned decimal that must span the whole of s.
+    static bool parseInt(string_view s, int& value) {
+        if (s.empty() || s[0] == '-') return false;
+        auto result = from_chars(s.data(), s.data() + s.size(), value);
+        return result.ec == errc() && result.ptr == s.data() + s.size();
+    }
+
+
+    // The number in a REQ<n> request ID, or -1 for any other ID.
+    static int requestNumber(string_view id) {
+        int number;
+        return id.substr(0, 3) == "REQ" && parseInt(id.substr(3), number) ? number : -1;
+    }
+
+
+    static bool isValidBloodType(const string& bt) {
+        string upperBT = toUpper(bt);
+        return find(VALID_BLOOD_TYPES.begin(), VALID_BLOOD_TYPES.end(), upperBT) != VALID_BLOOD_TYPES.end();
+    }
+
+
+    static int bloodTypeIndex(string_view bt) {
+        auto it = find(VALID_BLOOD_TYPES.begin(), VALID_BLOOD_TYPES.end(), bt);
+        return it == VALID_BLOOD_TYPES.end() ? -1 : int(it - VALID_BLOOD_TYPES.begin());
+    }
+
+
+    static BloodType toBloodType(string_view bt) {
+        int index = bloodTypeIndex(bt);
+        return index < 0 ? BloodType::Invalid : BloodType(index);
+    }
+
+
+    static string bloodTypeName(BloodType bt) {
+        return bt == BloodType::Invalid ? "" : VALID_BLOOD_TYPES[size_t(bt)];
+    }
+
+
+    static bool isValidRole(const string& role) {
+        return find(VALID_ROLES.begin(), VALID_ROLES.end(), role) != VALID_ROLES.end();
+    }
+
+
+    static UserRole toUserRole(string_view role) {
+        auto it = find(VALID_ROLES.begin(), VALID_ROLES.end(), role);
+        return it == VALID_ROLES.end() ? UserRole::Invalid : UserRole(it - VALID_ROLES.begin());
+    }
+
+
+    static string roleName(UserRole role) {
+        return role == UserRole::Invalid ? "" : VALID_ROLES[size_t(role)];
+    }
+
+
+    static tm toLocalTime(time_t t) {
+        tm local{};
+#ifdef _WIN32
+        localtime_s(&local, &t);
+#else
+        localtime_r(&t, &local);
+#endif
+        return local;
+    }
+
+
+    static int32_t today() {
+        return toDayNumber(getCurrentDate());
+    }
+
+
+    static string getCurrentDate() {
+        tm now = toLocalTime(time(nullptr));
+        char buf[40];
+        snprintf(buf, sizeof(buf), "%04d-%02d-%02d", now.tm_year+1900, now.tm_mon+1, now.tm_mday);
+        return string(buf);
+    }
+
+
+    // Splits s into views over its fields without allocating. Returns the
+    // number of fields in s; only the first N are stored.
+    template <size_t N>
+    static size_t splitView(string_view s, char delimiter, array<string_view, N>& tokens) {
+        size_t count = 0;
+        size_t start = 0;
+        while (true) {
+            size_t end = s.find(delimiter, start);
+            if (count < N) tokens[count] = s.substr(start, end == string_view::npos ? end : end - start);
+            count++;
+            if (end == string_view::npos) return count;
+            start = end + 1;
+        }
+    }
+
+    // True if needle occurs in text, ignoring ASCII case.
+    static bool containsIgnoreCase(string_view text, string_view needle) {
+        auto it = search(text.begin(), text.end(), needle.begin(), needle.end(), [](char a, char b) {
+            return toupper(static_cast<unsigned char>(a)) == toupper(static_cast<unsigned char>(b));
+        });
+        return it != text.end() || needle.empty();
+    }
+
+    // True if word occurs in text with no letter or digit directly before
+    // or after it.
+    static bool containsWord(string_view text, string_view word) {
+        if (word.empty()) return true;
+        for (size_t pos = text.find(word); pos != string_view::npos; pos = text.find(word, pos + 1)) {
+            size_t end = pos + word.size();
+            bool startsWord = pos == 0 || !isalnum(static_cast<unsigned char>(text[pos - 1]));
+            bool endsWord = end == text.size() || !isalnum(static_cast<unsigned char>(text[end]));
+            if (startsWord && endsWord) return true;
+        }
+        return false;
+    }
+
+    // Zero when the file is missing.
+    static uint64_t fileSize(const string& path) {
+        error_code ec;
+        uint64_t size = filesystem::file_size(path, ec);
+        return ec ? 0 : size;
+    }
+};
+
+
+// Byte-oriented LZ77 codec for closed log segments. A packed block is a
+// series of sequences: varint literal count, the literals, varint match
+// length (0 ends the block) and a 16-bit little-endian match distance.
+class LogCodec {
+    static void putVarint(string& out, size_t value) {
+        while (value >= 0x80) {
+            out += char(value | 0x80);
+            value >>= 7;
+        }
+        out += char(value);
+    }
+
+    static bool getVarint(const unsigned char*& p, const unsigned char* end, size_t& value) {
+        value = 0;
+        for (int shift = 0; p < end && shift < 35; shift += 7) {
+            unsigned char byte = *p++;
+            value |= size_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+
+    static uint32_t read32(const char* p) {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+public:
+    static constexpr char MAGIC[4] = {'B', 'B', 'L', 'Z'};
+
+    static string compress(string_view in) {
+        string out;
+        vector<uint32_t> table(1 << 14, UINT32_MAX);
+        size_t anchor = 0, i = 0;
+        while (i + 4 <= in.size()) {
+            uint32_t word = read32(in.data() + i);
+            uint32_t& slot = table[(word * 2654435761u) >> 18];
+            size_t candidate = slot;
+            slot = uint32_t(i);
+            if (candidate == UINT32_MAX || i - candidate > 0xFFFF || read32(in.data() + candidate) != word) {
+                ++i;
+                continue;
+            }
+            size_t length = 4;
+            while (i + length < in.size() && in[candidate + length] == in[i + length]) ++length;
+            putVarint(out, i - anchor);
+            out.append(in.data() + anchor, i - anchor);
+            putVarint(out, length);
+            out += char((i - candidate) & 0xFF);
+            out += char((i - candidate) >> 8);
+            i += length;
+            anchor = i;
+        }
+        putVarint(out, in.size() - anchor);
+        out.append(in.data() + anchor, in.size() - anchor);
+        putVarint(out, 0);
+        return out;
+    }
+
+    static bool decompress(string_view in, size_t rawSize, string& out) {
+        out.clear();
+        out.reserve(rawSize);
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(in.data());
+        const unsigned char* end = p + in.size();
+        while (true) {
+            size_t literals, length;
+            if (!getVarint(p, end, literals) || size_t(end - p) < literals) return false;
+            out.append(reinterpret_cast<const char*>(p), literals);
+            p += literals;
+            if (!getVarint(p, end, length)) return false;
+            if (length == 0) return out.size() == rawSize;
+            if (end - p < 2) return false;
+            size_t distance = size_t(p[0]) | size_t(p[1]) << 8;
+            p += 2;
+            if (distance == 0 || distance > out.size() || out.size() + length > rawSize) return false;
+            size_t from = out.size() - distance;
+            for (size_t k = 0; k < length; ++k) out += out[from + k];
+        }
+    }
+
+    // Packs a closed segment as "BBLZ", a uint32 block count, one
+    // {uint64 raw offset, uint32 raw size, uint32 packed size} entry per
+    // block, then the packed blocks. Blocks end on line boundaries so each
+    // can be read on its own.
+    static bool compressFile(const string& src, const string& dst) {
+        ifstream in(src, ios::binary);
+        if (!in) return false;
+        string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        string table, packed;
+        uint32_t blockCount = 0;
+        for (size_t start = 0; start < text.size(); ++blockCount) {
+            size_t end = min(text.size(), start + LOG_COMPRESSION_BLOCK);
+            size_t newline = end < text.size() ? text.rfind('\n', end - 1) : string::npos;
+            if (newline != string::npos && newline >= start) end = newline + 1;
+            string block = compress(string_view(text).substr(start, end - start));
+            uint64_t rawOffset = start;
+            uint32_t rawSize = uint32_t(end - start), packedSize = uint32_t(block.size());
+            table.append(reinterpret_cast<const char*>(&rawOffset), sizeof(rawOffset));
+            table.append(reinterpret_cast<const char*>(&rawSize), sizeof(rawSize));
+            table.append(reinterpret_cast<const char*>(&packedSize), sizeof(packedSize));
+            packed += block;
+            start = end;
+        }
+        ofstream out(dst, ios::binary | ios::trunc);
+        out.write(MAGIC, sizeof(MAGIC));
+        out.write(reinterpret_cast<const char*>(&blockCount), sizeof(blockCount));
+        out << table << packed;
+        out.close();
+        return !out.fail();
+    }
+};
+
+
+// Activity log storage. Entries are appended to the active segment
+// (activity_log.txt). When it outgrows the size or day-span limit it is
+// closed as activity_log.<seq>.txt, compressed to activity_log.<seq>.lz
+// if enabled, and a new active segment starts. The sidecar
+// activity_log.idx holds "<seq>|<date>|<offset>" for the first entry of
+// each day in each segment, so readers can seek straight to a day.
+struct LogRotationPolicy {
+    uint64_t maxSegmentBytes = LOG_SEGMENT_MAX_BYTES;
+    int32_t maxSegmentDays = LOG_SEGMENT_MAX_DAYS;
+    bool compressClosed = COMPRESS_CLOSED_LOG_SEGMENTS;
+};
+
+class SegmentedLog {
+public:
+    struct IndexEntry {
+        uint32_t seq;
+        int32_t day;
+        uint64_t offset;
+    };
+
+    static string segmentPath(uint32_t seq, bool compressed) {
+        char name[40];
+        snprintf(name, sizeof(name), "activity_log.%06u.%s", unsigned(seq), compressed ? "lz" : "txt");
+        return name;
+    }
+
+    static vector<IndexEntry> readIndex() {
+        vector<IndexEntry> entries;
+        ifstream file(ACTIVITY_LOG_INDEX_FILE);
+        string line;
+        while (getline(file, line)) {
+            array<string_view, 3> fields;
+            int seq;
+            uint64_t offset;
+            if (Utility::splitView(line, '|', fields) != 3 || !Utility::parseInt(fields[0], seq)) continue;
+            int32_t day = Utility::toDayNumber(fields[1]);
+            auto result = from_chars(fields[2].data(), fields[2].data() + fields[2].size(), offset);
+            if (day == INVALID_DAY || result.ec != errc()) continue;
+            entries.push_back({uint32_t(seq), day, offset});
+        }
+        return entries;
+    }
+
+    // The last indexed segment, unless it has already been closed.
+    static uint32_t activeSegment(const vector<IndexEntry>& entries) {
+        if (entries.empty()) return 0;
+        uint32_t seq = entries.back().seq;
+        error_code ec;
+        bool closed = filesystem::exists(segmentPath(seq, false), ec) || filesystem::exists(segmentPath(seq, true), ec);
+        return closed ? seq + 1 : seq;
+    }
+
+private:
+    LogRotationPolicy policy;
+    ofstream active;
+    ofstream index;
+    string buffer;
+    uint32_t activeSeq = 0;
+    uint64_t activeBytes = 0;
+    int32_t firstDay = INVALID_DAY;
+    int32_t lastDay = INVALID_DAY;
+
+    void writeBuffer() {
+        active.write(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+
+    void indexDay(int32_t day, uint64_t offset) {
+        index << activeSeq << '|' << Utility::fromDayNumber(day) << '|' << offset << '\n';
+        if (firstDay == INVALID_DAY) firstDay = day;
+        lastDay = day;
+    }
+
+    // Indexes an activity_log.txt written before segmentation existed.
+    void indexExistingLog() {
+        ifstream file(ACTIVITY_LOG_FILE, ios::binary);
+        string line;
+        uint64_t offset = 0;
+        while (getline(file, line)) {
+            int32_t day = line.size() >= 12 && line[0] == '[' ? Utility::toDayNumber(string_view(line).substr(1, 10)) : INVALID_DAY;
+            if (day != INVALID_DAY && day != lastDay) indexDay(day, offset);
+            offset += line.size() + 1;
+        }
+        index.flush();
+    }
+
+    void rotate() {
+        writeBuffer();
+        active.close();
+        string closed = segmentPath(activeSeq, false);
+        error_code ec;
+        filesystem::rename(ACTIVITY_LOG_FILE, closed, ec);
+        if (!ec) {
+            if (policy.compressClosed && LogCodec::compressFile(closed, segmentPath(activeSeq, true))) {
+                filesystem::remove(closed, ec);
+            }
+            ++activeSeq;
+            activeBytes = 0;
+            firstDay = lastDay = INVALID_DAY;
+        }
+        active.open(ACTIVITY_LOG_FILE, ios::app | ios::binary);
+    }
+
+public:
+    explicit SegmentedLog(LogRotationPolicy policy = LogRotationPolicy()) : policy(policy) {
+        vector<IndexEntry> entries = readIndex();
+        activeSeq = activeSegment(entries);
+        error_code ec;
+        uint64_t existing = filesystem::exists(ACTIVITY_LOG_FILE, ec) ? filesystem::file_size(ACTIVITY_LOG_FILE, ec) : 0;
+        activeBytes = ec ? 0 : existing;
+        index.open(ACTIVITY_LOG_INDEX_FILE, ios::app);
+        for (const IndexEntry& entry : entries) {
+            if (entry.seq != activeSeq) continue;
+            if (firstDay == INVALID_DAY) firstDay = entry.day;
+            lastDay = entry.day;
+        }
+        if (entries.empty() && activeBytes > 0) indexExistingLog();
+        active.open(ACTIVITY_LOG_FILE, ios::app | ios::binary);
+    }
+
+    ~SegmentedLog() { flush(); }
+
+    SegmentedLog(const SegmentedLog&) = delete;
+    SegmentedLog& operator=(const SegmentedLog&) = delete;
+
+    // Appends "<stamp><message>\n" for an entry made on the given day.
+    void append(int32_t day, string_view stamp, string_view message) {
+        bool tooLarge = activeBytes >= policy.maxSegmentBytes;
+        bool tooLong = day != INVALID_DAY && firstDay != INVALID_DAY && day - firstDay >= policy.maxSegmentDays;
+        if (activeBytes > 0 && (tooLarge || tooLong)) rotate();
+        if (day != INVALID_DAY && day != lastDay) indexDay(day, activeBytes);
+        buffer.append(stamp);
+        buffer.append(message);
+        buffer += '\n';
+        activeBytes += stamp.size() + message.size() + 1;
+        if (buffer.size() >= LOG_WRITE_BUFFER) writeBuffer();
+    }
+
+    void flush() {
+        writeBuffer();
+        active.flush();
+        index.flush();
+    }
+};
+
+
+class LoggerStrategy {
+public:
+    virtual ~LoggerStrategy() {}
+    virtual void log(const string& message) = 0;
+    // Blocks until every message logged so far has reached the file.
+    virtual void flush() {}
+};
+
+class FileLogger : public LoggerStrategy {
+    SegmentedLog logFile;
+public:
+    void log(const string& message) override {
+        string date = Utility::getCurrentDate();
+        logFile.append(Utility::toDayNumber(date), "[" + date + "] ", message);
+        logFile.flush();
+    }
+};
+
+class ConsoleLogger : public LoggerStrategy {
+public:
+    void log(const string& message) override {
+        cout << "[LOG] " << message << endl;
+    }
+};
+
+
+// Bounded lock-free multi-producer/multi-consumer ring buffer (Vyukov).
+// Capacity is rounded up to a power of two.
+template <typename T>
+class BoundedQueue {
+    struct Cell {
+        atomic<size_t> sequence;
+        T value;
+    };
+
+    unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) atomic<size_t> enqueuePos{0};
+    alignas(64) atomic<size_t> dequeuePos{0};
+
+public:
+    explicit BoundedQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        cells.reset(new Cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i) cells[i].sequence.store(i, memory_order_relaxed);
+    }
+
+    // Moves from value only on success.
+    bool tryPush(T& value) {
+        size_t pos = enqueuePos.load(memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[pos & mask];
+            size_t seq = cell.sequence.load(memory_order_acquire);
+            intptr_t diff = intptr_t(seq) - intptr_t(pos);
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    cell.value = move(value);
+                    cell.sequence.store(pos + 1, memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueuePos.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tryPop(T& value) {
+        size_t pos = dequeuePos.load(memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[pos & mask];
+            size_t seq = cell.sequence.load(memory_order_acquire);
+            intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+            if (diff == 0) {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    value = move(cell.value);
+                    cell.sequence.store(pos + mask + 1, memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeuePos.load(memory_order_relaxed);
+            }
+        }
+    }
+};
+
+
+// Queues messages for a background thread that writes them in batches.
+// The file is flushed every flushInterval and on destruction. When the
+// queue is full, producers either wait (Block) or discard the message and
+// bump a counter (Drop); the writer notes dropped messages in the log.
+class AsyncFileLogger : public LoggerStrategy {
+public:
+    enum class OverflowPolicy { Block, Drop };
+
+private:
+    struct Entry {
+        time_t time = 0;
+        string message;
+    };
+
+    SegmentedLog logFile;
+    BoundedQueue<Entry> queue;
+    OverflowPolicy policy;
+    chrono::milliseconds flushInterval;
+    atomic<size_t> dropped{0};
+    size_t droppedReported = 0;
+    atomic<bool> stopRequested{false};
+    // Set by producers waiting on a full queue (Block); cleared by the
+    // writer before it drains.
+    atomic<bool> producerWaiting{false};
+    mutex wakeMutex;
+    condition_variable wake;
+    condition_variable flushed;
+    uint64_t flushRequests = 0;
+    uint64_t flushesDone = 0;
+    thread writer;
+
+    time_t stampDayStart = 0;
+    time_t stampDayEnd = 0;
+    string stamp;
+    int32_t stampDay = INVALID_DAY;
+
+    const string& dateStamp(time_t t) {
+        if (t < stampDayStart || t >= stampDayEnd) {
+            tm local = Utility::toLocalTime(t);
+            char buf[40];
+            snprintf(buf, sizeof(buf), "[%04d-%02d-%02d] ", local.tm_year+1900, local.tm_mon+1, local.tm_mday);
+            stamp = buf;
+            stampDay = Utility::toDayNumber(string_view(stamp).substr(1, 10));
+            local.tm_hour = local.tm_min = local.tm_sec = 0;
+            local.tm_isdst = -1;
+            stampDayStart = mktime(&local);
+            local.tm_mday += 1;
+            stampDayEnd = mktime(&local);
+        }
+        return stamp;
+    }
+
+    void writerLoop() {
+        Entry entry;
+        auto lastFlush = chrono::steady_clock::now();
+        while (true) {
+            bool stopping = stopRequested.load();
+            uint64_t flushTicket;
+            {
+                lock_guard<mutex> lock(wakeMutex);
+                flushTicket = flushRequests;
+            }
+            producerWaiting = false;
+            while (queue.tryPop(entry)) {
+                const string& entryStamp = dateStamp(entry.time);
+                logFile.append(stampDay, entryStamp, entry.message);
+            }
+            size_t droppedNow = dropped.load();
+            if (droppedNow != droppedReported) {
+                const string& dropStamp = dateStamp(time(nullptr));
+                logFile.append(stampDay, dropStamp, to_string(droppedNow - droppedReported) + " log messages dropped.");
+                droppedReported = droppedNow;
+            }
+            auto now = chrono::steady_clock::now();
+            bool flushWanted = flushTicket != flushesDone;
+            if (stopping || flushWanted || now - lastFlush >= flushInterval) {
+                logFile.flush();
+                lastFlush = now;
+            }
+            unique_lock<mutex> lock(wakeMutex);
+            if (flushWanted) {
+                flushesDone = flushTicket;
+                flushed.notify_all();
+            }
+            if (stopping) return;
+            wake.wait_for(lock, flushInterval, [this] {
+                return flushRequests != flushesDone || stopRequested.load() || producerWaiting.load();
+            });
+        }
+    }
+
+public:
+    explicit AsyncFileLogger(chrono::milliseconds flushInterval = chrono::milliseconds(1000),
+                             size_t capacity = 4096, OverflowPolicy policy = OverflowPolicy::Block)
+        : queue(capacity), policy(policy), flushInterval(flushInterval) {
+        writer = thread(&AsyncFileLogger::writerLoop, this);
+    }
+
+    ~AsyncFileLogger() {
+        stopRequested = true;
+        wake.notify_one();
+        writer.join();
+    }
+
+    void log(const string& message) override {
+        Entry entry{time(nullptr), message};
+        while (!queue.tryPush(entry)) {
+            if (policy == OverflowPolicy::Drop) {
+                dropped++;
+                return;
+            }
+            if (!producerWaiting.load()) {
+                // Set under the mutex so the writer cannot miss it between
+                // checking its wait predicate and going to sleep.
+                lock_guard<mutex> lock(wakeMutex);
+                producerWaiting = true;
+            }
+            wake.notify_one();
+            this_thread::yield();
+        }
+        wake.notify_one();
+    }
+
+    void flush() override {
+        unique_lock<mutex> lock(wakeMutex);
+        uint64_t ticket = ++flushRequests;
+        wake.notify_one();
+        flushed.wait(lock, [&] { return flushesDone >= ticket; });
+    }
+
+    size_t droppedMessages() const { return dropped.load(); }
+};
+
+
+// Append-only change log replayed over the last snapshot of a table.
+// Records are "<op>|<payload>" with op I (insert), U (update) or D (delete).
+class Journal {
+    string path;
+    ofstream out;
+    int recordCount = 0;
+    mutable mutex journalMutex;
+
+public:
+    explicit Journal(const string& path) : path(path) {}
+
+    void append(char op, const string& payload) {
+        lock_guard<mutex> lock(journalMutex);
+        if (!out.is_open()) out.open(path, ios::app);
+        out << op << "|" << payload << "\n";
+        out.flush();
+        recordCount++;
+    }
+
+    template <typename Apply>
+    void replay(Apply apply) {
+        ifstream file(path);
+        if (!file.is_open()) return;
+        string line;
+        while (getline(file, line)) {
+            if (line.size() < 2 || line[1] != '|') continue;
+            apply(line[0], line.substr(2));
+            recordCount++;
+        }
+        file.close();
+    }
+
+    void reset() {
+        lock_guard<mutex> lock(journalMutex);
+        if (out.is_open()) out.close();
+        out.open(path, ios::trunc);
+        recordCount = 0;
+    }
+
+    int size() const {
+        lock_guard<mutex> lock(journalMutex);
+        return recordCount;
+    }
+};
+
+
+// Writes a file under a temporary name, syncs it to disk and only then
+// renames it over the original, so a crash leaves either the old or the
+// new file in place, never a torn one. Dropping the writer without
+// commit() discards the temporary file. In append mode writes go onto the
+// end of the file itself and commit() only syncs them; a crash can then
+// leave a partial last line.
+class AtomicFileWriter {
+    string path;
+    string tempPath;
+    string buffer;
+    bool failed = false;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+#else
+    int fd = -1;
+#endif
+
+    void flushBuffer() {
+        const char* data = buffer.data();
+        size_t remaining = buffer.size();
+        while (remaining > 0 && !failed) {
+#ifdef _WIN32
+            DWORD written = 0;
+            DWORD chunk = DWORD(min<size_t>(remaining, 1u << 30));
+            if (!WriteFile(file, data, chunk, &written, nullptr)) failed = true;
+#else
+            ssize_t written = ::write(fd, data, remaining);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                failed = true;
+                break;
+            }
+#endif
+            data += written;
+            remaining -= size_t(written);
+        }
+        buffer.clear();
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+    }
+
+public:
+    explicit AtomicFileWriter(const string& path, bool append = false) : path(path), tempPath(append ? "" : path + ".tmp") {
+        const string& target = append ? path : tempPath;
+#ifdef _WIN32
+        file = CreateFileA(target.c_str(), append ? FILE_APPEND_DATA : GENERIC_WRITE, 0, nullptr,
+                           append ? OPEN_ALWAYS : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        failed = file == INVALID_HANDLE_VALUE;
+#else
+        fd = open(target.c_str(), O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0644);
+        failed = fd < 0;
+#endif
+        buffer.reserve(FILE_WRITE_BUFFER);
+    }
+
+    ~AtomicFileWriter() {
+        if (tempPath.empty()) {
+            close();
+            return;
+        }
+        if (path.empty()) return;
+        close();
+        error_code ec;
+        filesystem::remove(tempPath, ec);
+    }
+
+    AtomicFileWriter(const AtomicFileWriter&) = delete;
+    AtomicFileWriter& operator=(const AtomicFileWriter&) = delete;
+
+    void write(const char* data, size_t size) {
+        buffer.append(data, size);
+        if (buffer.size() >= FILE_WRITE_BUFFER) flushBuffer();
+    }
+
+    AtomicFileWriter& operator<<(string_view text) {
+        write(text.data(), text.size());
+        return *this;
+    }
+
+    AtomicFileWriter& operator<<(char c) {
+        write(&c, 1);
+        return *this;
+    }
+
+    bool commit() {
+        flushBuffer();
+#ifdef _WIN32
+        if (!failed && !FlushFileBuffers(file)) failed = true;
+        close();
+        if (tempPath.empty()) return !failed;
+        if (!failed) failed = !MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+        if (!failed && fsync(fd) != 0) failed = true;
+        close();
+        if (tempPath.empty()) return !failed;
+        if (!failed) failed = rename(tempPath.c_str(), path.c_str()) != 0;
+        if (!failed) {
+            // The rename itself is only durable once the directory is synced.
+            string dir = filesystem::path(path).parent_path().string();
+            int dirFd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+            if (dirFd >= 0) {
+                fsync(dirFd);
+                ::close(dirFd);
+            }
+        }
+#endif
+        if (!failed) path.clear();
+        return !failed;
+    }
+};
+
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+    const char* base = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+
+public:
+    explicit MappedFile(const string& path) {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) return;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) return;
+        base = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if (base) length = size_t(fileSize.QuadPart);
+#else
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) return;
+        void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) return;
+        base = static_cast<const char*>(p);
+        length = size_t(st.st_size);
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (base) UnmapViewOfFile(base);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (base) munmap(const_cast<char*>(base), length);
+        if (fd >= 0) close(fd);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool isOpen() const { return base != nullptr; }
+    const char* data() const { return base; }
+    size_t size() const { return length; }
+
+    string_view text() const { return string_view(base, length); }
+
+    template <typename Handler>
+    static void forEachLine(const string& path, Handler handle) {
+        MappedFile file(path);
+        if (file.isOpen()) forEachLineIn(file.text(), handle);
+    }
+
+    template <typename Handler>
+    static void forEachLineIn(string_view text, Handler handle) {
+        size_t start = 0;
+        while (start < text.size()) {
+            size_t end = text.find('\n', start);
+            if (end == string_view::npos) end = text.size();
+            string_view line = text.substr(start, end - start);
+            if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+            handle(line);
+            start = end + 1;
+        }
+    }
+
+    // Splits text into at most `parts` pieces of similar size, each ending
+    // just after a line break (the last one at the end of the text).
+    static vector<string_view> splitAtLines(string_view text, size_t parts) {
+        vector<string_view> chunks;
+        size_t start = 0;
+        for (size_t i = 1; i <= parts && start < text.size(); ++i) {
+            size_t end = i == parts ? text.size() : max(start, text.size() / parts * i);
+            end = end >= text.size() ? text.size() : text.find('\n', end);
+            end = end == string_view::npos ? text.size() : min(end + 1, text.size());
+            chunks.push_back(text.substr(start, end - start));
+            start = end;
+        }
+        return chunks;
+    }
+
+    // Parses every line of text into Rows, in file order. parse(line, row)
+    // returns false to skip a line. Large texts are split into
+    // newline-aligned chunks parsed on their own threads and concatenated.
+    template <typename Row, typename Parse>
+    static vector<Row> parseLines(string_view text, Parse parse) {
+        size_t threads = max<size_t>(thread::hardware_concurrency(), 1);
+        vector<string_view> chunks = splitAtLines(text, min(threads, text.size() / PARALLEL_LOAD_CHUNK + 1));
+        vector<vector<Row>> parsed(chunks.size());
+        auto parseChunk = [&parse, &chunks, &parsed](size_t i) {
+            Row row;
+            forEachLineIn(chunks[i], [&](string_view line) {
+                if (parse(line, row)) parsed[i].push_back(move(row));
+            });
+        };
+        vector<thread> workers;
+        for (size_t i = 1; i < chunks.size(); ++i) workers.emplace_back(parseChunk, i);
+        if (!chunks.empty()) parseChunk(0);
+        for (thread& worker : workers) worker.join();
+        if (parsed.size() == 1) return move(parsed[0]);
+        size_t total = 0;
+        for (const vector<Row>& rows : parsed) total += rows.size();
+        vector<Row> rows;
+        rows.reserve(total);
+        for (vector<Row>& chunk : parsed) move(chunk.begin(), chunk.end(), back_inserter(rows));
+        return rows;
+    }
+};
+
+
+class BinaryWriter {
+    vector<char> buffer;
+
+public:
+    template <typename T>
+    void put(const T& value) {
+        const char* p = reinterpret_cast<const char*>(&value);
+        buffer.insert(buffer.end(), p, p + sizeof(T));
+    }
+
+    template <typename T>
+    void putArray(const vector<T>& values) {
+        const char* p = reinterpret_cast<const char*>(values.data());
+        buffer.insert(buffer.end(), p, p + values.size() * sizeof(T));
+    }
+
+    void putString(const string& s) {
+        put(uint32_t(s.size()));
+        buffer.insert(buffer.end(), s.begin(), s.end());
+    }
+
+    const vector<char>& data() const { return buffer; }
+};
+
+
+class BinaryReader {
+    const char* pos;
+    const char* end;
+    bool valid = true;
+
+public:
+    BinaryReader(const char* data, size_t size) : pos(data), end(data + size) {}
+
+    template <typename T>
+    T get() {
+        T value{};
+        if (size_t(end - pos) < sizeof(T)) { valid = false; return value; }
+        memcpy(&value, pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    template <typename T>
+    void getArray(vector<T>& values, size_t count) {
+        if (size_t(end - pos) / sizeof(T) < count) { valid = false; return; }
+        values.resize(count);
+        memcpy(values.data(), pos, count * sizeof(T));
+        pos += count * sizeof(T);
+    }
+
+    string getString() {
+        uint32_t len = get<uint32_t>();
+        if (!valid || size_t(end - pos) < len) { valid = false; return ""; }
+        string s(pos, len);
+        pos += len;
+        return s;
+    }
+
+    bool ok() const { return valid; }
+};
+
+
+// Versioned binary table snapshot: fixed header followed by a payload whose
+// FNV-1a checksum is stored in the header. Values are in host byte order.
+class BinarySnapshot {
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint32_t table;
+        uint32_t recordCount;
+        uint64_t payloadSize;
+        uint64_t checksum;
+    };
+
+    static constexpr uint32_t VERSION = 2;
+
+    static uint64_t checksum(const char* data, size_t size) {
+        uint64_t hash = 1469598103934665603ULL;
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= uint8_t(data[i]);
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+public:
+    enum Table : uint32_t { Users = 1, Inventory = 2, Requests = 3, ArchiveSummary = 4 };
+
+    static bool write(const string& path, Table table, uint32_t recordCount, const BinaryWriter& payload) {
+        const vector<char>& data = payload.data();
+        Header header;
+        memcpy(header.magic, "BBSN", 4);
+        header.version = VERSION;
+        header.table = table;
+        header.recordCount = recordCount;
+        header.payloadSize = data.size();
+        header.checksum = checksum(data.data(), data.size());
+        AtomicFileWriter file(path);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(data.data(), data.size());
+        return file.commit();
+    }
+
+    // Validates the header and checksum of a mapped snapshot and returns a
+    // reader positioned at the payload.
+    static bool open(const MappedFile& file, Table table, uint32_t& recordCount, BinaryReader& reader) {
+        if (!file.isOpen() || file.size() < sizeof(Header)) return false;
+        Header header;
+        memcpy(&header, file.data(), sizeof(header));
+        if (memcmp(header.magic, "BBSN", 4) != 0 || header.version != VERSION || header.table != table) return false;
+        if (header.payloadSize != file.size() - sizeof(Header)) return false;
+        const char* payload = file.data() + sizeof(Header);
+        if (checksum(payload, header.payloadSize) != header.checksum) return false;
+        recordCount = header.recordCount;
+        reader = BinaryReader(payload, header.payloadSize);
+        return true;
+    }
+
+    // A snapshot is only used when the text file has not been edited since.
+    static bool isFresh(const string& snapshotPath, const string& textPath) {
+        error_code ec;
+        if (!filesystem::exists(snapshotPath, ec)) return false;
+        if (!filesystem::exists(textPath, ec)) return true;
+        return filesystem::last_write_time(textPath, ec) <= filesystem::last_write_time(snapshotPath, ec);
+    }
+};
+
+
+// Reads "[YYYY-MM-DD] message" log entries backward, newest segment first.
+// A date range upper bound is looked up in the sidecar index, so the scan
+// starts at that day's offset instead of the end of the log. Entries are in
+// time order, so it stops at the first entry older than the range. Text
+// segments are mapped; compressed segments are unpacked one block at a
+// time, newest block first.
+class ActivityLogReader {
+    // Scans one chunk of whole lines backward. Returns false when done.
+    static bool scanChunk(string_view text, const LogQuery& q, vector<string>& entries) {
+        size_t end = text.size();
+        while (end > 0) {
+            if (entries.size() >= q.limit) return false;
+            size_t start = text.rfind('\n', end - 1);
+            start = start == string_view::npos ? 0 : start + 1;
+            string_view line = text.substr(start, end - start);
+            end = start == 0 ? 0 : start - 1;
+            if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+            if (line.empty()) continue;
+
+            int32_t day = line.size() >= 12 && line[0] == '[' ? Utility::toDayNumber(line.substr(1, 10)) : INVALID_DAY;
+            bool dated = day != INVALID_DAY;
+            if (dated && day < q.fromDay) return false;
+            if ((q.fromDay != INT32_MIN || q.toDay != INT32_MAX) && (!dated || day > q.toDay)) continue;
+            string_view message = dated ? line.substr(min(line.size(), size_t(13))) : line;
+            if (!Utility::containsWord(message, q.userID)) continue;
+            if (!Utility::containsIgnoreCase(message, q.keyword)) continue;
+            entries.emplace_back(line);
+        }
+        return entries.size() < q.limit;
+    }
+
+    // Scans the part of a segment before endOffset. Returns false when done.
+    static bool scanSegment(const string& textPath, const string& packedPath, uint64_t endOffset,
+                            const LogQuery& q, vector<string>& entries) {
+        MappedFile text(textPath);
+        if (text.isOpen()) {
+            return scanChunk(string_view(text.data(), size_t(min<uint64_t>(text.size(), endOffset))), q, entries);
+        }
+        MappedFile packed(packedPath);
+        if (!packed.isOpen() || packed.size() < 8 || memcmp(packed.data(), LogCodec::MAGIC, 4) != 0) return true;
+        BinaryReader header(packed.data() + 4, packed.size() - 4);
+        uint32_t blockCount = header.get<uint32_t>();
+        struct Block { uint64_t rawOffset; uint32_t rawSize; uint32_t packedSize; size_t position; };
+        vector<Block> blocks;
+        size_t position = 8 + size_t(blockCount) * 16;
+        for (uint32_t i = 0; i < blockCount && header.ok(); ++i) {
+            Block block;
+            block.rawOffset = header.get<uint64_t>();
+            block.rawSize = header.get<uint32_t>();
+            block.packedSize = header.get<uint32_t>();
+            block.position = position;
+            position += block.packedSize;
+            blocks.push_back(block);
+        }
+        if (!header.ok() || position > packed.size()) return true;
+        string raw;
+        for (auto it = blocks.rbegin(); it != blocks.rend(); ++it) {
+            if (it->rawOffset >= endOffset) continue;
+            if (!LogCodec::decompress(string_view(packed.data() + it->position, it->packedSize), it->rawSize, raw)) return true;
+            size_t length = size_t(min<uint64_t>(raw.size(), endOffset - it->rawOffset));
+            if (!scanChunk(string_view(raw).substr(0, length), q, entries)) return false;
+        }
+        return true;
+    }
+
+public:
+    // Returns up to q.limit matching entries, newest first.
+    static vector<string> tail(const LogQuery& q) {
+        vector<string> entries;
+        if (q.limit == 0 || q.fromDay > q.toDay) return entries;
+        vector<SegmentedLog::IndexEntry> index = SegmentedLog::readIndex();
+        uint32_t activeSeq = SegmentedLog::activeSegment(index);
+        uint32_t seq = activeSeq;
+        uint64_t endOffset = UINT64_MAX;
+        if (q.toDay != INT32_MAX) {
+            for (const auto& entry : index) {
+                if (entry.day > q.toDay) {
+                    seq = entry.seq;
+                    endOffset = entry.offset;
+                    break;
+                }
+            }
+        }
+        for (int64_t s = seq; s >= 0; --s, endOffset = UINT64_MAX) {
+            string textPath = uint32_t(s) == activeSeq ? ACTIVITY_LOG_FILE : SegmentedLog::segmentPath(uint32_t(s), false);
+            if (!scanSegment(textPath, SegmentedLog::segmentPath(uint32_t(s), true), endOffset, q, entries)) break;
+        }
+        return entries;
+    }
+};
+
+
+// One row of the user table, held by value so the registry is a single
+// contiguous array. Donors carry a blood type; everyone else has Invalid.
+class User {
+private:
+    string userID;
+    string name;
+    string contact;
+    string password;
+    UserRole role = UserRole::Invalid;
+    BloodType bloodType = BloodType::Invalid;
+
+public:
+    User() {}
+    User(const string& id, const string& name, const string& contact, const string& password, UserRole role,
+         BloodType bloodType = BloodType::Invalid)
+        : userID(id), name(name), contact(contact), password(password), role(role),
+          bloodType(role == UserRole::Donor ? bloodType : BloodType::Invalid) {}
+
+    const string& getUserID() const { return userID; }
+    const string& getName() const { return name; }
+    const string& getContact() const { return contact; }
+    const string& getPassword() const { return password; }
+    UserRole getRole() const { return role; }
+    string getRoleName() const { return Utility::roleName(role); }
+    bool isDonor() const { return role == UserRole::Donor; }
+    BloodType getBloodTypeCode() const { return bloodType; }
+    string getBloodType() const { return Utility::bloodTypeName(bloodType); }
+
+    void setName(const string& n) { name = n; }
+    void setContact(const string& c) { contact = c; }
+    void setPassword(const string& p) { password = p; }
+    void setBloodType(BloodType bt) { if (isDonor()) bloodType = bt; }
+
+    void displayUserInfo() const {
+        cout << "UserID: " << userID << "\nName: " << name << "\nContact: " << contact << "\nRole: " << getRoleName() << "\n";
+        if (isDonor()) cout << "Blood Type: " << getBloodType() << "\n";
+    }
+
+    bool authenticate(const string& pass) const {
+        return password == pass;
+    }
+};
+
+
+class BloodUnit {
+private:
+    string bloodType;
+    int quantity;
+    string donationDate;
+    string donorName; 
+
+public:
+    BloodUnit() : bloodType(""), quantity(0), donationDate(""), donorName("") {}
+    BloodUnit(const string& bt, int qty, const string& date, const string& donor)
+        : bloodType(bt), quantity(qty), donationDate(date), donorName(donor) {}
+
+    string getBloodType() const { return bloodType; }
+    int getQuantity() const { return quantity; }
+    string getDonationDate() const { return donationDate; }
+    string getDonorName() const { return donorName; } 
+
+    void setBloodType(const string& bt) { bloodType = bt; }
+    void setQuantity(int qty) { quantity = qty; }
+    void setDonationDate(const string& date) { donationDate = date; }
+    void setDonorName(const string& donor) { donorName = donor; } 
+
+    void displayBloodInfo() const {
+        cout << "Blood Type: " << bloodType << "\nQuantity: " << quantity
+             << "\nDonation Date: " << donationDate
+             << "\nDonor Name: " << donorName << "\n"; 
+    }
+};
+
+
+class StringPool {
+    vector<string> strings;
+    unordered_map<string, uint32_t> ids;
+    string lookupKey;
+
+public:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    size_t size() const { return strings.size(); }
+
+    // Safe alongside other readers, unlike intern().
+    uint32_t find(string_view s) const {
+        auto it = ids.find(string(s));
+        return it == ids.end() ? NONE : it->second;
+    }
+
+    uint32_t intern(string_view s) {
+        lookupKey.assign(s.data(), s.size());
+        auto it = ids.find(lookupKey);
+        if (it != ids.end()) return it->second;
+        uint32_t id = uint32_t(strings.size());
+        strings.push_back(lookupKey);
+        ids.emplace(lookupKey, id);
+        return id;
+    }
+
+    const string& get(uint32_t id) const { return strings[id]; }
+};
+
+
+// Structure-of-arrays inventory: one column per field so scans over type
+// and quantity stay contiguous. Donor names are interned. Every unit has a
+// persistent ID; deleted units are tombstoned in place and, together with
+// drained units, removed by compact().
+class BloodInventoryStore {
+    vector<uint32_t> unitIDs;
+    vector<uint8_t> live;
+    vector<BloodType> types;
+    vector<int> quantities;
+    vector<int32_t> donationDays;
+    vector<uint32_t> donorIDs;
+    StringPool donorNames;
+    // Indexed by unit ID, which are issued in sequence; EMPTY_ID for IDs
+    // with no live unit.
+    vector<uint32_t> slotByID;
+    uint32_t nextUnitID = 1;
+    size_t deadCount = 0;
+    // Approvals of different types drain units concurrently.
+    atomic<size_t> emptyCount{0};
+
+    static constexpr uint32_t EMPTY_ID = UINT32_MAX;
+
+public:
+    static constexpr size_t NO_SLOT = SIZE_MAX;
+
+    size_t size() const { return types.size(); }
+    size_t liveCount() const { return types.size() - deadCount; }
+    bool empty() const { return liveCount() == 0; }
+    size_t reclaimableCount() const { return deadCount + emptyCount; }
+
+    uint32_t idAt(size_t i) const { return unitIDs[i]; }
+    bool isLive(size_t i) const { return live[i] != 0; }
+    BloodType typeAt(size_t i) const { return types[i]; }
+    int quantityAt(size_t i) const { return quantities[i]; }
+    int32_t donationDayAt(size_t i) const { return donationDays[i]; }
+    const string& donorNameAt(size_t i) const { return donorNames.get(donorIDs[i]); }
+    uint32_t donorIDAt(size_t i) const { return donorIDs[i]; }
+    uint32_t findDonorID(string_view name) const { return donorNames.find(name); }
+
+    size_t findSlot(uint32_t id) const {
+        return id < slotByID.size() && slotByID[id] != EMPTY_ID ? slotByID[id] : NO_SLOT;
+    }
+
+    void setQuantityAt(size_t i, int qty) {
+        emptyCount += (qty == 0) - (quantities[i] == 0);
+        quantities[i] = qty;
+    }
+
+    BloodUnit get(size_t i) const {
+        return BloodUnit(Utility::bloodTypeName(types[i]), quantities[i],
+                         Utility::fromDayNumber(donationDays[i]), donorNameAt(i));
+    }
+
+    // Appends a unit and returns its slot. A zero or already used id gets a
+    // fresh one.
+    size_t push_back(BloodType type, int quantity, int32_t donationDay, string_view donorName, uint32_t id = 0) {
+        if (id == 0 || id == EMPTY_ID || findSlot(id) != NO_SLOT) id = nextUnitID;
+        nextUnitID = max(nextUnitID, id + 1);
+        size_t slot = types.size();
+        unitIDs.push_back(id);
+        live.push_back(1);
+        types.push_back(type);
+        quantities.push_back(quantity);
+        donationDays.push_back(donationDay);
+        donorIDs.push_back(donorNames.intern(donorName));
+        if (id >= slotByID.size()) slotByID.resize(size_t(id) + 1, EMPTY_ID);
+        slotByID[id] = uint32_t(slot);
+        if (quantity == 0) emptyCount++;
+        return slot;
+    }
+
+    size_t push_back(const BloodUnit& unit, uint32_t id = 0) {
+        return push_back(Utility::toBloodType(unit.getBloodType()), unit.getQuantity(),
+                         Utility::toDayNumber(unit.getDonationDate()), unit.getDonorName(), id);
+    }
+
+    void set(size_t i, const BloodUnit& unit) {
+        types[i] = Utility::toBloodType(unit.getBloodType());
+        setQuantityAt(i, unit.getQuantity());
+        donationDays[i] = Utility::toDayNumber(unit.getDonationDate());
+        donorIDs[i] = donorNames.intern(unit.getDonorName());
+    }
+
+    void tombstone(size_t i) {
+        if (!live[i]) return;
+        if (quantities[i] == 0) emptyCount--;
+        live[i] = 0;
+        slotByID[unitIDs[i]] = EMPTY_ID;
+        deadCount++;
+    }
+
+    void reserve(size_t count) {
+        size_t total = types.size() + count;
+        unitIDs.reserve(total);
+        live.reserve(total);
+        types.reserve(total);
+        quantities.reserve(total);
+        donationDays.reserve(total);
+        donorIDs.reserve(total);
+        slotByID.reserve(max(slotByID.size(), size_t(nextUnitID)) + count);
+    }
+
+    void clear() {
+        unitIDs.clear();
+        live.clear();
+        types.clear();
+        quantities.clear();
+        donationDays.clear();
+        donorIDs.clear();
+        donorNames = StringPool();
+        slotByID.clear();
+        nextUnitID = 1;
+        deadCount = 0;
+        emptyCount = 0;
+    }
+
+    // Drops tombstoned and drained units. Slots of the remaining units
+    // change; IDs do not. Returns the number of units removed.
+    size_t compact() {
+        size_t kept = 0;
+        for (size_t i = 0; i < types.size(); ++i) {
+            if (!live[i] || quantities[i] == 0) continue;
+            unitIDs[kept] = unitIDs[i];
+            types[kept] = types[i];
+            quantities[kept] = quantities[i];
+            donationDays[kept] = donationDays[i];
+            donorIDs[kept] = donorIDs[i];
+            kept++;
+        }
+        size_t removed = types.size() - kept;
+        unitIDs.resize(kept);
+        live.assign(kept, 1);
+        types.resize(kept);
+        quantities.resize(kept);
+        donationDays.resize(kept);
+        donorIDs.resize(kept);
+        fill(slotByID.begin(), slotByID.end(), EMPTY_ID);
+        for (size_t i = 0; i < kept; ++i) slotByID[unitIDs[i]] = uint32_t(i);
+        deadCount = 0;
+        emptyCount = 0;
+        return removed;
+    }
+
+    // Writes live units only.
+    void writeBinary(BinaryWriter& out) const {
+        if (deadCount == 0) {
+            out.putArray(unitIDs);
+            out.putArray(types);
+            out.putArray(quantities);
+            out.putArray(donationDays);
+            out.putArray(donorIDs);
+        } else {
+            out.putArray(liveColumn(unitIDs));
+            out.putArray(liveColumn(types));
+            out.putArray(liveColumn(quantities));
+            out.putArray(liveColumn(donationDays));
+            out.putArray(liveColumn(donorIDs));
+        }
+        out.put(uint32_t(donorNames.size()));
+        for (uint32_t id = 0; id < donorNames.size(); ++id) out.putString(donorNames.get(id));
+    }
+
+    bool readBinary(BinaryReader& in, size_t count) {
+        in.getArray(unitIDs, count);
+        in.getArray(types, count);
+        in.getArray(quantities, count);
+        in.getArray(donationDays, count);
+        in.getArray(donorIDs, count);
+        uint32_t nameCount = in.get<uint32_t>();
+        donorNames = StringPool();
+        for (uint32_t id = 0; id < nameCount && in.ok(); ++id) donorNames.intern(in.getString());
+        if (!in.ok() || donorNames.size() != nameCount) return false;
+        for (uint32_t id : donorIDs) {
+            if (id >= donorNames.size()) return false;
+        }
+        live.assign(count, 1);
+        for (size_t i = 0; i < count; ++i) {
+            uint32_t id = unitIDs[i];
+            if (id == 0 || id == EMPTY_ID || findSlot(id) != NO_SLOT) return false;
+            if (id >= slotByID.size()) slotByID.resize(size_t(id) + 1, EMPTY_ID);
+            slotByID[id] = uint32_t(i);
+            nextUnitID = max(nextUnitID, id + 1);
+            if (quantities[i] == 0) emptyCount++;
+        }
+        return true;
+    }
+
+private:
+    template <typename T>
+    vector<T> liveColumn(const vector<T>& column) const {
+        vector<T> result;
+        result.reserve(liveCount());
+        for (size_t i = 0; i < column.size(); ++i) {
+            if (live[i]) result.push_back(column[i]);
+        }
+        return result;
+    }
+};
+
+
+class BloodRequest {
+private:
+    string requestID;
+    string requestorID;
+    string bloodType;
+    int quantity;
+    string requestDate;
+    string status; 
+
+public:
+    BloodRequest() : requestID(""), requestorID(""), bloodType(""), quantity(0), requestDate(""), status("Pending") {}
+    BloodRequest(const string& reqID, const string& reqorID, const string& bt, int qty, const string& date, const string& stat = "Pending")
+        : requestID(reqID), requestorID(reqorID), bloodType(bt), quantity(qty), requestDate(date), status(stat) {}
+
+    string getRequestID() const { return requestID; }
+    string getRequestorID() const { return requestorID; }
+    string getBloodType() const { return bloodType; }
+    int getQuantity() const { return quantity; }
+    string getRequestDate() const { return requestDate; }
+    string getStatus() const { return status; }
+
+    void setStatus(const string& s) { status = s; }
+    void setQuantity(int q) { quantity = q; }
+
+    void displayRequestInfo() const {
+        cout << "Request ID: " << requestID << "\nRequestor ID: " << requestorID << "\nBlood Type: " << bloodType
+             << "\nQuantity: " << quantity << "\nRequest Date: " << requestDate << "\nStatus: " << status << "\n";
+    }
+};
+
+
+// Holds the inventory locks of a set of blood types (bit i = type i),
+// taken in ascending type order: exclusively to draw stock, shared to
+// read it.
+class TypeLockGuard {
+public:
+    enum Mode { Exclusive, Shared };
+
+private:
+    array<shared_mutex, BLOOD_TYPE_COUNT>& locks;
+    uint32_t mask;
+    Mode mode;
+
+public:
+    TypeLockGuard(array<shared_mutex, BLOOD_TYPE_COUNT>& locks, uint32_t mask, Mode mode = Exclusive)
+        : locks(locks), mask(mask), mode(mode) {
+        for (size_t t = 0; t < BLOOD_TYPE_COUNT; ++t) {
+            if (!(mask & (1u << t))) continue;
+            if (mode == Shared) locks[t].lock_shared();
+            else locks[t].lock();
+        }
+    }
+
+    ~TypeLockGuard() {
+        for (size_t t = BLOOD_TYPE_COUNT; t-- > 0;) {
+            if (!(mask & (1u << t))) continue;
+            if (mode == Shared) locks[t].unlock_shared();
+            else locks[t].unlock();
+        }
+    }
+
+    TypeLockGuard(const TypeLockGuard&) = delete;
+    TypeLockGuard& operator=(const TypeLockGuard&) = delete;
+};
+const uint32_t ALL_BLOOD_TYPES = (1u << BLOOD_TYPE_COUNT) - 1;
+
+
+enum class Operation {
+    LoadUsers, LoadInventory, LoadRequests, LoadArchive, ScanArchive, SaveUsers, SaveInventory, SaveRequests, ArchiveRequests,
+    Commit, ExpirySweep, Login, Approve, Reject, Donate, InventorySummary, UserSummary, RequestsSummary, Count
+};
+const array<const char*, size_t(Operation::Count)> OPERATION_NAMES = {
+    "load_users", "load_inventory", "load_requests", "load_archive", "scan_archive", "save_users", "save_inventory", "save_requests",
+    "archive_requests", "commit", "expiry_sweep", "login", "approve_request", "reject_request", "donate",
+    "inventory_summary", "user_summary", "requests_summary"
+};
+
+// Per-operation counters and latency histograms. Bucket b holds calls
+// that took under 2^b microseconds (and at least half that); the last
+// bucket takes everything slower. Recording is a few relaxed atomic adds.
+class OperationMetrics {
+public:
+    static constexpr size_t BUCKETS = 28;
+
+    void record(Operation op, chrono::nanoseconds elapsed, uint64_t rows, uint64_t bytes) {
+        Stats& s = stats[size_t(op)];
+        uint64_t nanos = uint64_t(elapsed.count());
+        s.calls.fetch_add(1, memory_order_relaxed);
+        s.rows.fetch_add(rows, memory_order_relaxed);
+        s.bytes.fetch_add(bytes, memory_order_relaxed);
+        s.totalNanos.fetch_add(nanos, memory_order_relaxed);
+        s.buckets[bucketFor(nanos / 1000)].fetch_add(1, memory_order_relaxed);
+        uint64_t seen = s.maxNanos.load(memory_order_relaxed);
+        while (nanos > seen && !s.maxNanos.compare_exchange_weak(seen, nanos, memory_order_relaxed)) {}
+    }
+
+    string format() const {
+        string out = "Operation             Calls      Mean       p50       p99       Max        Rows       Bytes\n";
+        char line[160];
+        for (size_t op = 0; op < stats.size(); ++op) {
+            const Stats& s = stats[op];
+            uint64_t calls = s.calls.load(memory_order_relaxed);
+            if (calls == 0) continue;
+            snprintf(line, sizeof(line), "%-18s %8llu %9s %9s %9s %9s %11llu %11llu\n", OPERATION_NAMES[op],
+                     (unsigned long long)calls, formatDuration(s.totalNanos.load(memory_order_relaxed) / 1000.0 / calls).c_str(),
+                     ("<" + formatDuration(percentile(s, calls, 0.50))).c_str(),
+                     ("<" + formatDuration(percentile(s, calls, 0.99))).c_str(),
+                     formatDuration(s.maxNanos.load(memory_order_relaxed) / 1000.0).c_str(),
+                     (unsigned long long)s.rows.load(memory_order_relaxed), (unsigned long long)s.bytes.load(memory_order_relaxed));
+            out += line;
+        }
+        return out;
+    }
+
+    // The table followed by the raw histogram of every operation called.
+    bool dump(const string& path) const {
+        ofstream file(path);
+        if (!file) return false;
+        file << format() << "\nHistograms (upper bound: calls)\n";
+        for (size_t op = 0; op < stats.size(); ++op) {
+            const Stats& s = stats[op];
+            if (s.calls.load(memory_order_relaxed) == 0) continue;
+            file << OPERATION_NAMES[op] << ":";
+            for (size_t b = 0; b < BUCKETS; ++b) {
+                uint64_t n = s.buckets[b].load(memory_order_relaxed);
+                if (n) file << " " << (b + 1 == BUCKETS ? ">" + formatDuration(bucketLimit(b - 1)) : "<" + formatDuration(bucketLimit(b))) << ":" << n;
+            }
+            file << "\n";
+        }
+        return bool(file);
+    }
+
+private:
+    struct Stats {
+        atomic<uint64_t> calls{0}, rows{0}, bytes{0}, totalNanos{0}, maxNanos{0};
+        array<atomic<uint64_t>, BUCKETS> buckets{};
+    };
+    array<Stats, size_t(Operation::Count)> stats;
+
+    static size_t bucketFor(uint64_t micros) {
+        size_t b = 0;
+        while (micros) {
+            micros >>= 1;
+            ++b;
+        }
+        return min(b, BUCKETS - 1);
+    }
+
+    static double bucketLimit(size_t b) { return double(1ull << b); }
+
+    // Upper bound of the bucket holding the given fraction of calls.
+    static double percentile(const Stats& s, uint64_t calls, double fraction) {
+        uint64_t target = max<uint64_t>(1, uint64_t(fraction * calls + 0.5)), seen = 0;
+        for (size_t b = 0; b < BUCKETS; ++b) {
+            seen += s.buckets[b].load(memory_order_relaxed);
+            if (seen >= target) return bucketLimit(b);
+        }
+        return bucketLimit(BUCKETS - 1);
+    }
+
+    static string formatDuration(double micros) {
+        char buf[32];
+        if (micros < 1000) snprintf(buf, sizeof(buf), "%.1fus", micros);
+        else if (micros < 1e6) snprintf(buf, sizeof(buf), "%.1fms", micros / 1e3);
+        else snprintf(buf, sizeof(buf), "%.2fs", micros / 1e6);
+        return buf;
+    }
+};
+
+
+// Records the time from construction to destruction, plus whatever rows
+// and bytes the operation reports, against one operation.
+class OperationTimer {
+    OperationMetrics& metrics;
+    Operation op;
+    chrono::steady_clock::time_point start;
+    uint64_t rows = 0;
+    uint64_t bytes = 0;
+
+public:
+    OperationTimer(OperationMetrics& metrics, Operation op)
+        : metrics(metrics), op(op), start(chrono::steady_clock::now()) {}
+
+    ~OperationTimer() {
+        metrics.record(op, chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start), rows, bytes);
+    }
+
+    void touched(uint64_t rowCount, uint64_t byteCount = 0) {
+        rows += rowCount;
+        bytes += byteCount;
+    }
+
+    OperationTimer(const OperationTimer&) = delete;
+    OperationTimer& operator=(const OperationTimer&) = delete;
+};
+
+
+// Finalized (approved or rejected) requests, moved out of the requests
+// table into an append-only file in the same line format. Nothing is read
+// at startup: the first history lookup scans the file once into an index
+// of line offsets, and rows are read back from disk on demand. A sidecar
+// written on every append keeps the per-status counts and a Bloom filter
+// of archived IDs, so summaries and lookups of unknown IDs never build the
+// index. Requests already archived (a crash between archiving and
+// checkpointing the table) are not appended again; in older files with
+// duplicates the first copy wins.
+class RequestArchive {
+public:
+    // Query rows from the archive carry this bit on their entry number.
+    static constexpr size_t ROW_BIT = size_t(1) << (sizeof(size_t) * 8 - 1);
+
+private:
+    struct Entry {
+        uint64_t offset;
+        int32_t day;
+        int number;
+        BloodType type;
+        uint8_t status;
+    };
+
+    static constexpr size_t FILTER_BITS_PER_ID = 10;
+    static constexpr size_t FILTER_HASHES = 7;
+    static constexpr size_t FILTER_MIN_WORDS = 1024;
+
+    string path;
+    string summaryPath;
+    OperationMetrics& metrics;
+    mutex archiveMutex;
+    bool loaded = false;
+    vector<Entry> entries;
+    unordered_map<string, size_t> byID;
+    unordered_map<string, vector<size_t>> byRequestor;
+    set<RequestRow> byDay;
+    // The sidecar summary, read or rebuilt on first use.
+    bool summarized = false;
+    array<size_t, 3> statusCounts{};
+    size_t archivedCount = 0;
+    vector<uint64_t> filter;
+
+    static uint8_t statusIndex(string_view status) {
+        auto it = find(REQUEST_STATUSES.begin(), REQUEST_STATUSES.end(), status);
+        return it == REQUEST_STATUSES.end() ? 0xFF : uint8_t(it - REQUEST_STATUSES.begin());
+    }
+
+    // id|requestor|type|quantity|date|status
+    void indexLine(string_view line, uint64_t offset) {
+        array<string_view, 6> tokens;
+        if (Utility::splitView(line, '|', tokens) != 6 || byID.count(string(tokens[0]))) return;
+        size_t entry = entries.size();
+        uint8_t status = statusIndex(tokens[5]);
+        entries.push_back({offset, Utility::toDayNumber(tokens[4]), Utility::requestNumber(tokens[0]),
+                           Utility::toBloodType(tokens[2]), status});
+        byID.emplace(string(tokens[0]), entry);
+        byRequestor[string(tokens[1])].push_back(entry);
+        byDay.insert({entries.back().day, entries.back().number, entry});
+    }
+
+    void ensureLoaded() {
+        if (loaded) return;
+        OperationTimer timer(metrics, Operation::LoadArchive);
+        loaded = true;
+        MappedFile file(path);
+        string_view text = file.text();
+        MappedFile::forEachLineIn(text, [&](string_view line) { indexLine(line, uint64_t(line.data() - text.data())); });
+        timer.touched(entries.size(), text.size());
+    }
+
+    // FNV-1a, fixed so the persisted filter stays valid across builds.
+    static uint64_t hashID(string_view id) {
+        uint64_t hash = 1469598103934665603ULL;
+        for (char c : id) {
+            hash ^= uint8_t(c);
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    bool mightContain(string_view id) const {
+        uint64_t hash = hashID(id), step = (hash >> 32) | 1, bits = filter.size() * 64;
+        for (size_t i = 0; i < FILTER_HASHES; ++i, hash += step) {
+            if (!(filter[hash % bits / 64] >> (hash % bits % 64) & 1)) return false;
+        }
+        return true;
+    }
+
+    void summarize(string_view id, string_view status) {
+        uint64_t hash = hashID(id), step = (hash >> 32) | 1, bits = filter.size() * 64;
+        for (size_t i = 0; i < FILTER_HASHES; ++i, hash += step) filter[hash % bits / 64] |= uint64_t(1) << (hash % bits % 64);
+        uint8_t index = statusIndex(status);
+        if (index != 0xFF) statusCounts[index]++;
+        archivedCount++;
+    }
+
+    // One pass over the file, keeping the first copy of each ID. The
+    // filter gets room for twice the IDs so it is rarely rebuilt.
+    void rebuildSummary() {
+        OperationTimer timer(metrics, Operation::ScanArchive);
+        MappedFile file(path);
+        string_view text = file.text();
+        unordered_set<string_view> seen;
+        vector<pair<string_view, string_view>> rows;
+        MappedFile::forEachLineIn(text, [&](string_view line) {
+            array<string_view, 6> tokens;
+            if (Utility::splitView(line, '|', tokens) == 6 && seen.insert(tokens[0]).second) rows.push_back({tokens[0], tokens[5]});
+        });
+        statusCounts = {};
+        archivedCount = 0;
+        filter.assign(max(FILTER_MIN_WORDS, (rows.size() * 2 * FILTER_BITS_PER_ID + 63) / 64), 0);
+        for (const auto& row : rows) summarize(row.first, row.second);
+        timer.touched(rows.size(), text.size());
+    }
+
+    // The sidecar only counts if it was written for the file as it is now.
+    bool readSummary() {
+        MappedFile file(summaryPath);
+        BinaryReader in(nullptr, 0);
+        uint32_t count = 0;
+        if (!BinarySnapshot::open(file, BinarySnapshot::ArchiveSummary, count, in)) return false;
+        uint64_t archiveSize = in.get<uint64_t>();
+        for (size_t& statusCount : statusCounts) statusCount = size_t(in.get<uint64_t>());
+        uint64_t words = in.get<uint64_t>();
+        if (!in.ok() || archiveSize != Utility::fileSize(path) || words == 0) return false;
+        in.getArray(filter, size_t(words));
+        archivedCount = count;
+        return in.ok();
+    }
+
+    void writeSummary() {
+        BinaryWriter out;
+        out.put(uint64_t(Utility::fileSize(path)));
+        for (size_t statusCount : statusCounts) out.put(uint64_t(statusCount));
+        out.put(uint64_t(filter.size()));
+        out.putArray(filter);
+        BinarySnapshot::write(summaryPath, BinarySnapshot::ArchiveSummary, uint32_t(archivedCount), out);
+    }
+
+    void ensureSummarized() {
+        if (summarized) return;
+        summarized = true;
+        if (readSummary()) return;
+        rebuildSummary();
+        writeSummary();
+    }
+
+    // Which of the IDs are archived: from the index if it is loaded,
+    // otherwise by one pass over the file that keeps nothing else.
+    unordered_set<string> findIDs(const unordered_set<string>& ids) {
+        unordered_set<string> found;
+        if (loaded) {
+            for (const string& id : ids) {
+                if (byID.count(id)) found.insert(id);
+            }
+            return found;
+        }
+        OperationTimer timer(metrics, Operation::ScanArchive);
+        MappedFile file(path);
+        MappedFile::forEachLineIn(file.text(), [&](string_view line) {
+            string id(line.substr(0, line.find('|')));
+            if (ids.count(id)) found.insert(move(id));
+        });
+        timer.touched(found.size(), file.text().size());
+        return found;
+    }
+
+    vector<BloodRequest> read(const vector<size_t>& wanted) {
+        vector<BloodRequest> rows(wanted.size());
+        ifstream file(path, ios::binary);
+        string line;
+        for (size_t i = 0; i < wanted.size(); ++i) {
+            file.clear();
+            file.seekg(streamoff(entries[wanted[i]].offset));
+            if (!getline(file, line)) continue;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            array<string_view, 6> tokens;
+            int qty = 0;
+            if (Utility::splitView(line, '|', tokens) != 6 || !Utility::parseInt(tokens[3], qty)) continue;
+            rows[i] = BloodRequest(string(tokens[0]), string(tokens[1]), string(tokens[2]), qty, string(tokens[4]),
+                                   string(tokens[5]));
+        }
+        return rows;
+    }
+
+public:
+    RequestArchive(const string& path, const string& summaryPath, OperationMetrics& metrics)
+        : path(path), summaryPath(summaryPath), metrics(metrics) {}
+
+    RequestArchive(const RequestArchive&) = delete;
+    RequestArchive& operator=(const RequestArchive&) = delete;
+
+    bool empty() {
+        lock_guard<mutex> lock(archiveMutex);
+        return loaded ? entries.empty() : Utility::fileSize(path) == 0;
+    }
+
+    // Appends the rows not archived yet and syncs them to disk, then the
+    // summary. The index, if loaded, picks them up.
+    bool append(const vector<BloodRequest>& rows) {
+        lock_guard<mutex> lock(archiveMutex);
+        OperationTimer timer(metrics, Operation::ArchiveRequests);
+        ensureSummarized();
+        unordered_set<string> candidates;
+        for (const BloodRequest& req : rows) {
+            if (mightContain(req.getRequestID())) candidates.insert(req.getRequestID());
+        }
+        unordered_set<string> archived = candidates.empty() ? unordered_set<string>() : findIDs(candidates);
+        uint64_t start = Utility::fileSize(path);
+        string text;
+        if (start > 0) {
+            // Never glue a row onto a line torn by a crash.
+            ifstream tail(path, ios::binary);
+            tail.seekg(streamoff(start - 1));
+            if (tail.get() != '\n') text += '\n';
+        }
+        vector<pair<uint64_t, size_t>> lines;
+        vector<const BloodRequest*> added;
+        for (const BloodRequest& req : rows) {
+            if (archived.count(req.getRequestID())) continue;
+            added.push_back(&req);
+            lines.push_back({start + text.size(), text.size()});
+            text += req.getRequestID() + "|" + req.getRequestorID() + "|" + req.getBloodType() + "|"
+                  + to_string(req.getQuantity()) + "|" + req.getRequestDate() + "|" + req.getStatus() + "\n";
+        }
+        if (added.empty()) return true;
+        AtomicFileWriter file(path, true);
+        file << text;
+        if (!file.commit()) return false;
+        for (const BloodRequest* req : added) summarize(req->getRequestID(), req->getStatus());
+        if (archivedCount * FILTER_BITS_PER_ID > filter.size() * 64) rebuildSummary();
+        // A failed write leaves a stale sidecar, rebuilt on next use.
+        writeSummary();
+        if (loaded) {
+            for (const auto& line : lines) {
+                size_t end = text.find('\n', line.second);
+                indexLine(string_view(text).substr(line.second, end - line.second), line.first);
+            }
+        }
+        timer.touched(rows.size(), text.size());
+        return true;
+    }
+
+    // Unknown IDs are answered from the filter; only a possible match
+    // looks at the file.
+    bool contains(const string& reqID) {
+        lock_guard<mutex> lock(archiveMutex);
+        ensureSummarized();
+        if (!mightContain(reqID)) return false;
+        return findIDs({reqID}).count(reqID) != 0;
+    }
+
+    bool findRequest(const string& reqID, BloodRequest& req) {
+        lock_guard<mutex> lock(archiveMutex);
+        ensureLoaded();
+        auto it = byID.find(reqID);
+        if (it == byID.end()) return false;
+        req = read({it->second})[0];
+        return true;
+    }
+
+    vector<BloodRequest> requestsBy(const string& requestorID) {
+        lock_guard<mutex> lock(archiveMutex);
+        ensureLoaded();
+        auto it = byRequestor.find(requestorID);
+        return it == byRequestor.end() ? vector<BloodRequest>() : read(it->second);
+    }
+
+    // Requests per status, indexed like REQUEST_STATUSES.
+    array<size_t, 3> countByStatus() {
+        lock_guard<mutex> lock(archiveMutex);
+        ensureSummarized();
+        return statusCounts;
+    }
+
+    // Appends up to `wanted` rows matching the query, newest first, as
+    // (day, number, entry | ROW_BIT). Paging is left to the caller.
+    void query(const RequestQuery& q, size_t wanted, vector<RequestRow>& matches) {
+        lock_guard<mutex> lock(archiveMutex);
+        ensureLoaded();
+        uint8_t status = q.status.empty() ? 0xFF : 0xFE;
+        for (size_t i = 0; i < REQUEST_STATUSES.size(); ++i) {
+            if (Utility::toUpper(REQUEST_STATUSES[i]) == Utility::toUpper(q.status)) status = uint8_t(i);
+        }
+        if (status == 0xFE) return;
+        size_t found = 0;
+        auto visit = [&](size_t entry) {
+            const Entry& e = entries[entry];
+            if (e.day < q.fromDay || e.day > q.toDay) return true;
+            if (status != 0xFF && e.status != status) return true;
+            if (q.type != BloodType::Invalid && e.type != q.type) return true;
+            matches.push_back({e.day, e.number, entry | ROW_BIT});
+            return ++found < wanted;
+        };
+        if (!q.requestorID.empty()) {
+            auto it = byRequestor.find(q.requestorID);
+            if (it == byRequestor.end()) return;
+            vector<RequestRow> rows;
+            for (size_t entry : it->second) rows.push_back({entries[entry].day, entries[entry].number, entry});
+            sort(rows.rbegin(), rows.rend());
+            for (const auto& row : rows) {
+                if (!visit(get<2>(row))) break;
+            }
+        } else {
+            auto begin = byDay.lower_bound({q.fromDay, INT32_MIN, 0});
+            for (auto it = byDay.upper_bound({q.toDay, INT32_MAX, SIZE_MAX}); it != begin;) {
+                if (!visit(get<2>(*--it))) break;
+            }
+        }
+    }
+
+    // Reads query rows (entry | ROW_BIT) back from disk.
+    vector<BloodRequest> readRows(const vector<size_t>& rows) {
+        lock_guard<mutex> lock(archiveMutex);
+        vector<size_t> wanted;
+        for (size_t row : rows) wanted.push_back(row & ~ROW_BIT);
+        return read(wanted);
+    }
+};
+
+
+// The blood bank itself, with no terminal I/O: owns the tables, their
+// indexes, locks and persistence, and exposes typed operations that
+// report an OperationResult. Safe to call from several threads at once.
+// The console menus, batch mode, server and benchmarks all drive it.
+class BloodBankCore {
+private:
+    // Users by value, in registration order; userIndex maps IDs to positions.
+    vector<User> users;
+    BloodInventoryStore bloodInventory;
+    // Every live unit as (drained, donation day, slot), per type (last
+    // entry: unrecognised types). Units with stock left sort first, oldest
+    // donation first, so that part of each index is also what allocation
+    // draws from. Answers inventory queries too.
+    using UnitKey = tuple<bool, int32_t, uint32_t>;
+    array<set<UnitKey>, BLOOD_TYPE_COUNT + 1> unitsByType;
+    array<int, BLOOD_TYPE_COUNT> bloodTypeTotals{};
+    // Units donated before this day have expired: they stay listed but are
+    // skipped by allocation and left out of the totals. Written under
+    // inventoryMutex.
+    atomic<int32_t> oldestUsableDay{INT32_MIN};
+    // Open requests, plus those finalized since the last checkpoint, which
+    // moves them to the archive.
+    vector<BloodRequest> bloodRequests;
+    // Requests ordered by request date, then request number. Answers
+    // request queries.
+    set<RequestRow> requestsByDay;
+
+    unordered_map<string, size_t> userIndex;
+    unordered_map<string, size_t> requestIndex;
+    unordered_map<string, vector<size_t>> requestsByRequestor;
+
+    LoggerStrategy* loggerStrategy = nullptr;
+    int requestIDCounter = 1000;
+
+    Journal inventoryJournal;
+    Journal requestsJournal;
+    bool binarySnapshots = false;
+    bool persistenceDeferred = false;
+
+    // Lock order: usersMutex, requestsMutex, inventoryMutex, then
+    // typeLocks in ascending type order. Adding, changing or removing
+    // units takes inventoryMutex exclusively. Approvals take it shared
+    // plus exclusive locks on the types they draw from, so approvals of
+    // unrelated types run in parallel. Reads take it shared plus shared
+    // locks on the types they look at, so they run alongside each other
+    // and only wait for approvals of those types.
+    mutable shared_mutex usersMutex;
+    mutable shared_mutex requestsMutex;
+    mutable shared_mutex inventoryMutex;
+    mutable array<shared_mutex, BLOOD_TYPE_COUNT> typeLocks;
+    // Requests claimed by an approval that is still drawing stock.
+    // Guarded by requestsMutex.
+    unordered_set<string> approvalsInFlight;
+
+    mutable OperationMetrics metrics;
+    // Lock order: after requestsMutex.
+    mutable RequestArchive archive;
+
+    // Group commit: changes mark their table dirty and the commit thread
+    // writes dirty tables together. See commitDirty().
+    static constexpr uint32_t USERS_TABLE = 1, INVENTORY_TABLE = 2, REQUESTS_TABLE = 4, REQUEST_ID_TABLE = 8;
+    static constexpr uint32_t ALL_TABLES = 15;
+    atomic<uint32_t> dirtyTables{0};
+    atomic<int> pendingChanges{0};
+    // Lock order: commitMutex before any table lock.
+    mutex commitMutex;
+    mutex commitSignalMutex;
+    condition_variable commitSignal;
+    bool commitDue = false;
+    bool stopCommitting = false;
+    thread commitThread;
+
+    // Log entries are tagged with the user acting on this thread.
+    static thread_local string actor;
+
+public:
+    // Loads the tables from the working directory.
+    BloodBankCore()
+        : inventoryJournal(BLOOD_JOURNAL_FILE), requestsJournal(REQUESTS_JOURNAL_FILE), archive(REQUESTS_ARCHIVE_FILE, REQUESTS_ARCHIVE_SUMMARY_FILE, metrics) {
+        setLoggerStrategy(new AsyncFileLogger());
+        error_code ec;
+        binarySnapshots = filesystem::exists(USERS_SNAPSHOT_FILE, ec) || filesystem::exists(BLOOD_SNAPSHOT_FILE, ec)
+                       || filesystem::exists(REQUESTS_SNAPSHOT_FILE, ec);
+        oldestUsableDay = Utility::today() - SHELF_LIFE_DAYS + 1;
+        // The tables share no state, so with cores to spare they load side
+        // by side.
+        if (thread::hardware_concurrency() > 1) {
+            thread usersLoader(&BloodBankCore::loadUsers, this);
+            thread inventoryLoader(&BloodBankCore::loadBloodInventory, this);
+            loadBloodRequests();
+            usersLoader.join();
+            inventoryLoader.join();
+        } else {
+            loadUsers();
+            loadBloodInventory();
+            loadBloodRequests();
+        }
+        loadRequestIDCounter();
+        commitThread = thread(&BloodBankCore::commitLoop, this);
+    }
+
+    ~BloodBankCore() {
+        stopCommitThread();
+        saveAllData();
+        metrics.dump(METRICS_FILE);
+        users.clear();
+        if (loggerStrategy) delete loggerStrategy;
+    }
+
+    BloodBankCore(const BloodBankCore&) = delete;
+    BloodBankCore& operator=(const BloodBankCore&) = delete;
+
+    // Binary snapshots are written alongside the text files at every save and
+    // preferred on load. Turning them off removes the .bin files.
+    void setBinarySnapshots(bool enabled) {
+        binarySnapshots = enabled;
+        if (!enabled) {
+            error_code ec;
+            filesystem::remove(USERS_SNAPSHOT_FILE, ec);
+            filesystem::remove(BLOOD_SNAPSHOT_FILE, ec);
+            filesystem::remove(REQUESTS_SNAPSHOT_FILE, ec);
+        }
+    }
+
+    void setLoggerStrategy(LoggerStrategy* strategy) {
+        if (loggerStrategy) delete loggerStrategy;
+        loggerStrategy = strategy;
+    }
+
+    // Entries logged on this thread from now on are tagged with userID
+    // (blank for none), so the activity log can be filtered by user.
+    static void setActor(const string& userID) {
+        actor = userID;
+    }
+
+    void log(const string& msg) {
+        if (!loggerStrategy) return;
+        loggerStrategy->log(actor.empty() ? msg : msg + " (by " + actor + ")");
+    }
+
+    void saveAllData() {
+        markDirty(ALL_TABLES);
+        commitDirty();
+    }
+
+    // Stops journaling for a bulk load; resumePersistence() then saves
+    // every table once.
+    void deferPersistence() {
+        persistenceDeferred = true;
+    }
+
+    void resumePersistence() {
+        persistenceDeferred = false;
+        saveAllData();
+    }
+
+    bool authenticateUser(const string& id, const string& pass, User& user) const {
+        OperationTimer timer(metrics, Operation::Login);
+        bool found = findUser(id, user);
+        timer.touched(1);
+        return found && user.authenticate(pass);
+    }
+
+    // Copies the user out; the table may move rows once the lock is released.
+    bool findUser(const string& id, User& user) const {
+        shared_lock<shared_mutex> lock(usersMutex);
+        auto it = userIndex.find(id);
+        if (it == userIndex.end()) return false;
+        user = users[it->second];
+        return true;
+    }
+
+    bool hasUser(const string& id) const {
+        shared_lock<shared_mutex> lock(usersMutex);
+        return userIndex.count(id) != 0;
+    }
+
+    size_t forEachUser(const function<void(const User&)>& visit) const {
+        shared_lock<shared_mutex> lock(usersMutex);
+        for (const User& user : users) visit(user);
+        return users.size();
+    }
+
+    // bloodType is required for donors and ignored otherwise.
+    OperationResult addUser(const string& id, const string& name, const string& contact, const string& password,
+                            const string& role, const string& bloodType = "") {
+        UserRole userRole = Utility::toUserRole(role);
+        if (id.empty() || name.empty() || password.empty() || !Utility::isNumeric(contact) || userRole == UserRole::Invalid) {
+            return OperationResult::InvalidInput;
+        }
+        BloodType type = Utility::toBloodType(Utility::toUpper(bloodType));
+        if (userRole == UserRole::Donor && type == BloodType::Invalid) return OperationResult::InvalidInput;
+        {
+            unique_lock<shared_mutex> lock(usersMutex);
+            if (userIndex.count(id)) return OperationResult::AlreadyExists;
+            users.emplace_back(id, name, contact, password, userRole, type);
+            userIndex.emplace(id, users.size() - 1);
+        }
+        log("New user registered: " + id + " Role: " + role);
+        markDirty(USERS_TABLE);
+        return OperationResult::Ok;
+    }
+
+    // Blank fields keep their current value. The blood type only applies
+    // to donors.
+    OperationResult updateUser(const string& id, const string& name, const string& contact, const string& bloodType) {
+        if ((!contact.empty() && !Utility::isNumeric(contact)) || (!bloodType.empty() && !Utility::isValidBloodType(bloodType))) {
+            return OperationResult::InvalidInput;
+        }
+        {
+            unique_lock<shared_mutex> lock(usersMutex);
+            auto it = userIndex.find(id);
+            if (it == userIndex.end()) return OperationResult::NotFound;
+            User& user = users[it->second];
+            if (!name.empty()) user.setName(name);
+            if (!contact.empty()) user.setContact(contact);
+            if (!bloodType.empty()) user.setBloodType(Utility::toBloodType(Utility::toUpper(bloodType)));
+        }
+        log("User updated: " + id);
+        markDirty(USERS_TABLE);
+        return OperationResult::Ok;
+    }
+
+    OperationResult deleteUser(const string& id) {
+        {
+            unique_lock<shared_mutex> lock(usersMutex);
+            auto it = userIndex.find(id);
+            if (it == userIndex.end()) return OperationResult::NotFound;
+            // Keep registration order: close the gap and shift the later positions.
+            size_t pos = it->second;
+            userIndex.erase(it);
+            users.erase(users.begin() + pos);
+            for (size_t i = pos; i < users.size(); ++i) userIndex[users[i].getUserID()] = i;
+        }
+        log("User deleted: " + id);
+        markDirty(USERS_TABLE);
+        return OperationResult::Ok;
+    }
+
+    OperationResult addUnit(const string& bloodType, int quantity, const string& date, const string& donorName,
+                            uint32_t* unitID = nullptr) {
+        if (!Utility::isValidBloodType(bloodType) || quantity <= 0 || !Utility::isValidDate(date)) {
+            return OperationResult::InvalidInput;
+        }
+        string type = Utility::toUpper(bloodType);
+        unique_lock<shared_mutex> lock(inventoryMutex);
+        size_t slot = addBloodUnitRecord(BloodUnit(type, quantity, date, donorName));
+        if (unitID) *unitID = bloodInventory.idAt(slot);
+        log("Blood unit added: Unit #" + to_string(bloodInventory.idAt(slot)) + " " + type
+            + " Qty: " + to_string(quantity) + " Donor: " + donorName);
+        journalBloodUnitInsert(slot);
+        checkpointBloodInventoryIfNeeded();
+        return OperationResult::Ok;
+    }
+
+    bool findUnit(uint32_t unitID, BloodUnit& unit) const {
+        shared_lock<shared_mutex> lock(inventoryMutex);
+        size_t slot = bloodInventory.findSlot(unitID);
+        if (slot == BloodInventoryStore::NO_SLOT) return false;
+        // A unit's type only changes under the exclusive inventoryMutex.
+        TypeLockGuard types(typeLocks, typeMask(bloodInventory.typeAt(slot)), TypeLockGuard::Shared);
+        unit = bloodInventory.get(slot);
+        return true;
+    }
+
+    // Drained units keep a quantity of 0, so only negative quantities are
+    // refused here.
+    OperationResult updateUnit(uint32_t unitID, const BloodUnit& unit) {
+        if (!Utility::isValidBloodType(unit.getBloodType()) || unit.getQuantity() < 0
+            || !Utility::isValidDate(unit.getDonationDate())) {
+            return OperationResult::InvalidInput;
+        }
+        BloodUnit normalized = unit;
+        normalized.setBloodType(Utility::toUpper(unit.getBloodType()));
+        {
+            unique_lock<shared_mutex> lock(inventoryMutex);
+            size_t slot = bloodInventory.findSlot(unitID);
+            if (slot == BloodInventoryStore::NO_SLOT) return OperationResult::NotFound;
+            replaceBloodUnitRecord(slot, normalized);
+            journalBloodUnitUpdate(slot);
+            checkpointBloodInventoryIfNeeded();
+        }
+        log("Blood unit updated: Unit #" + to_string(unitID));
+        return OperationResult::Ok;
+    }
+
+    OperationResult deleteUnit(uint32_t unitID) {
+        {
+            unique_lock<shared_mutex> lock(inventoryMutex);
+            size_t slot = bloodInventory.findSlot(unitID);
+            if (slot == BloodInventoryStore::NO_SLOT) return OperationResult::NotFound;
+            tombstoneBloodUnitRecord(slot);
+            journalBloodUnitDelete(unitID);
+            compactInventoryIfNeeded();
+            checkpointBloodInventoryIfNeeded();
+        }
+        log("Blood unit deleted: Unit #" + to_string(unitID));
+        return OperationResult::Ok;
+    }
+
+    // Adds a unit of the donor's type, donated today.
+    OperationResult donate(const string& userID, int quantity) {
+        OperationTimer timer(metrics, Operation::Donate);
+        if (quantity <= 0) return OperationResult::InvalidInput;
+        string donorName, bloodType;
+        {
+            shared_lock<shared_mutex> lock(usersMutex);
+            auto it = userIndex.find(userID);
+            if (it == userIndex.end()) return OperationResult::NotFound;
+            const User& donor = users[it->second];
+            if (!donor.isDonor()) return OperationResult::NotDonor;
+            donorName = donor.getName();
+            bloodType = donor.getBloodType();
+        }
+        unique_lock<shared_mutex> lock(inventoryMutex);
+        size_t slot = addBloodUnitRecord(BloodUnit(bloodType, quantity, Utility::getCurrentDate(), donorName));
+        log("Donor " + userID + " donated " + to_string(quantity) + "ml of " + bloodType
+            + " (Unit #" + to_string(bloodInventory.idAt(slot)) + ")");
+        journalBloodUnitInsert(slot);
+        timer.touched(1);
+        checkpointBloodInventoryIfNeeded();
+        return OperationResult::Ok;
+    }
+
+    bool inventoryEmpty() const {
+        shared_lock<shared_mutex> lock(inventoryMutex);
+        return bloodInventory.empty();
+    }
+
+    int availableStock(BloodType recipient, bool allowSubstitution) const {
+        shared_lock<shared_mutex> lock(inventoryMutex);
+        TypeLockGuard types(typeLocks, donorTypesFor(recipient, allowSubstitution), TypeLockGuard::Shared);
+        return availableFor(recipient, allowSubstitution);
+    }
+
+    OperationResult submitRequest(const string& requestorID, const string& bloodType, int quantity, const string& date,
+                                  string* requestID = nullptr) {
+        if (!Utility::isValidBloodType(bloodType) || quantity <= 0 || !Utility::isValidDate(date)) {
+            return OperationResult::InvalidInput;
+        }
+        if (!hasUser(requestorID)) return OperationResult::NotFound;
+        unique_lock<shared_mutex> lock(requestsMutex);
+        string reqID = generateRequestID();
+        addBloodRequest(BloodRequest(reqID, requestorID, Utility::toUpper(bloodType), quantity, date));
+        log("New blood request: " + reqID + " by " + requestorID);
+        journalBloodRequest('I', bloodRequests.back());
+        if (requestID) *requestID = reqID;
+        return OperationResult::Ok;
+    }
+
+    // Claims the request, draws stock holding only the locks of the types
+    // it may use, then records the outcome, so approvals of unrelated
+    // types overlap.
+    OperationResult approve(const string& reqID, vector<BloodAllocation>* allocations = nullptr,
+                            bool allowSubstitution = false) {
+        OperationTimer timer(metrics, Operation::Approve);
+        BloodType bloodType;
+        int quantity;
+        {
+            unique_lock<shared_mutex> lock(requestsMutex);
+            auto it = requestIndex.find(reqID);
+            if (it == requestIndex.end()) {
+                // Requests leave the table only once archived.
+                lock.unlock();
+                return archive.contains(reqID) ? OperationResult::NotPending : OperationResult::NotFound;
+            }
+            const BloodRequest& req = bloodRequests[it->second];
+            if (req.getStatus() != "Pending" || approvalsInFlight.count(reqID)) return OperationResult::NotPending;
+            approvalsInFlight.insert(reqID);
+            bloodType = Utility::toBloodType(req.getBloodType());
+            quantity = req.getQuantity();
+        }
+
+        vector<BloodAllocation> allocated;
+        bool filled;
+        {
+            shared_lock<shared_mutex> lock(inventoryMutex);
+            TypeLockGuard types(typeLocks, donorTypesFor(bloodType, allowSubstitution));
+            filled = allocateForRequest(bloodType, quantity, allowSubstitution, allocated);
+        }
+
+        {
+            // A checkpoint may have moved the request meanwhile; it is
+            // still pending, so it is still in the table.
+            unique_lock<shared_mutex> lock(requestsMutex);
+            approvalsInFlight.erase(reqID);
+            if (!filled) return OperationResult::InsufficientStock;
+            finishApproval(bloodRequests[requestIndex.at(reqID)], allocated);
+        }
+        timer.touched(allocated.size() + 1);
+        if (allocations) *allocations = allocated;
+        maintainInventory();
+        return OperationResult::Ok;
+    }
+
+    vector<OperationResult> approve(const vector<string>& requestIDs, bool allowSubstitution = false) {
+        vector<OperationResult> results;
+        results.reserve(requestIDs.size());
+        for (const string& reqID : requestIDs) results.push_back(approve(reqID, nullptr, allowSubstitution));
+        return results;
+    }
+
+    OperationResult reject(const string& reqID) {
+        OperationTimer timer(metrics, Operation::Reject);
+        unique_lock<shared_mutex> lock(requestsMutex);
+        auto it = requestIndex.find(reqID);
+        if (it == requestIndex.end()) {
+            lock.unlock();
+            return archive.contains(reqID) ? OperationResult::NotPending : OperationResult::NotFound;
+        }
+        BloodRequest* req = &bloodRequests[it->second];
+        if (req->getStatus() != "Pending" || approvalsInFlight.count(reqID)) return OperationResult::NotPending;
+        req->setStatus("Rejected");
+        timer.touched(1);
+        log("Request rejected: " + reqID);
+        journalBloodRequest('U', *req);
+        return OperationResult::Ok;
+    }
+
+    vector<OperationResult> reject(const vector<string>& requestIDs) {
+        vector<OperationResult> results;
+        results.reserve(requestIDs.size());
+        for (const string& reqID : requestIDs) results.push_back(reject(reqID));
+        return results;
+    }
+
+    // Approves every pending request that stock can cover, oldest request
+    // date first (then by request number), and saves inventory and
+    // requests once at the end.
+    BulkApprovalReport approveAllPending(bool allowSubstitution) {
+        unique_lock<shared_mutex> requestsLock(requestsMutex);
+        unique_lock<shared_mutex> inventoryLock(inventoryMutex);
+        vector<size_t> pending;
+        for (size_t i = 0; i < bloodRequests.size(); ++i) {
+            const BloodRequest& req = bloodRequests[i];
+            if (req.getStatus() == "Pending" && !approvalsInFlight.count(req.getRequestID())) pending.push_back(i);
+        }
+        vector<int32_t> days(bloodRequests.size());
+        for (size_t i : pending) days[i] = Utility::toDayNumber(bloodRequests[i].getRequestDate());
+        sort(pending.begin(), pending.end(), [&](size_t a, size_t b) {
+            if (days[a] != days[b]) return days[a] < days[b];
+            const string idA = bloodRequests[a].getRequestID(), idB = bloodRequests[b].getRequestID();
+            return idA.size() != idB.size() ? idA.size() < idB.size() : idA < idB;
+        });
+
+        BulkApprovalReport report;
+        bool wasDeferred = persistenceDeferred;
+        persistenceDeferred = true;
+        vector<BloodAllocation> allocated;
+        for (size_t i : pending) {
+            BloodRequest& req = bloodRequests[i];
+            BloodType bloodType = Utility::toBloodType(req.getBloodType());
+            int available = availableFor(bloodType, allowSubstitution);
+            allocated.clear();
+            if (available < req.getQuantity()) {
+                report.shortfalls.emplace_back(req.getRequestID(), req.getQuantity() - available);
+            } else if (allocateForRequest(bloodType, req.getQuantity(), allowSubstitution, allocated)) {
+                finishApproval(req, allocated);
+                report.approved.emplace_back(req.getRequestID(), req.getQuantity());
+            }
+        }
+        persistenceDeferred = wasDeferred;
+        compactInventoryIfNeeded();
+        if (!wasDeferred) {
+            if (!checkpointBloodInventory()) markDirty(INVENTORY_TABLE);
+            if (!checkpointBloodRequests()) markDirty(REQUESTS_TABLE);
+        }
+        log("Bulk approval: " + to_string(report.approved.size()) + " approved, "
+            + to_string(report.shortfalls.size()) + " short");
+        return report;
+    }
+
+    // Falls back to the archive, loading its index on first use.
+    bool findRequest(const string& reqID, BloodRequest& req) const {
+        shared_lock<shared_mutex> lock(requestsMutex);
+        auto it = requestIndex.find(reqID);
+        if (it == requestIndex.end()) return archive.findRequest(reqID, req);
+        req = bloodRequests[it->second];
+        return true;
+    }
+
+    // Archived requests first, then the ones still in the table.
+    vector<BloodRequest> requestsBy(const string& requestorID) const {
+        shared_lock<shared_mutex> lock(requestsMutex);
+        vector<BloodRequest> found = archive.requestsBy(requestorID);
+        auto it = requestsByRequestor.find(requestorID);
+        if (it != requestsByRequestor.end()) {
+            for (size_t pos : it->second) found.push_back(bloodRequests[pos]);
+        }
+        return found;
+    }
+
+    bool hasRequests() const {
+        shared_lock<shared_mutex> lock(requestsMutex);
+        return !bloodRequests.empty() || !archive.empty();
+    }
+
+    // Query and render under the table's read locks, so rows cannot
+    // change while the page is built.
+    string renderInventoryPage(const InventoryQuery& q, QueryPage& page) const {
+        shared_lock<shared_mutex> lock(inventoryMutex);
+        uint32_t wanted = q.type == BloodType::Invalid ? ALL_BLOOD_TYPES : typeMask(q.type);
+        TypeLockGuard types(typeLocks, wanted, TypeLockGuard::Shared);
+        page = queryInventory(q);
+        return renderPage(page, q.offset, UNIT_ROW_HEADER, [this](string& rows, size_t slot) { appendUnitRow(rows, slot); });
+    }
+
+    string renderRequestPage(const RequestQuery& q, QueryPage& page) const {
+        shared_lock<shared_mutex> lock(requestsMutex);
+        page = queryRequests(q);
+        vector<size_t> archivedRows;
+        for (size_t row : page.rows) {
+            if (row & RequestArchive::ROW_BIT) archivedRows.push_back(row);
+        }
+        vector<BloodRequest> archived = archivedRows.empty() ? vector<BloodRequest>() : archive.readRows(archivedRows);
+        size_t nextArchived = 0;
+        return renderPage(page, q.offset, REQUEST_ROW_HEADER, [&](string& rows, size_t row) {
+            appendRequestRow(rows, row & RequestArchive::ROW_BIT ? archived[nextArchived++] : bloodRequests[row]);
+        });
+    }
+
+    string formatInventorySummary() const {
+        OperationTimer timer(metrics, Operation::InventorySummary);
+        shared_lock<shared_mutex> lock(inventoryMutex);
+        TypeLockGuard types(typeLocks, ALL_BLOOD_TYPES, TypeLockGuard::Shared);
+        string out;
+        for (size_t t = 0; t < BLOOD_TYPE_COUNT; ++t) {
+            out += VALID_BLOOD_TYPES[t] + ": " + to_string(bloodTypeTotals[t]) + " ml\n";
+        }
+        timer.touched(BLOOD_TYPE_COUNT);
+        return out;
+    }
+
+    string formatUserSummary() const {
+        OperationTimer timer(metrics, Operation::UserSummary);
+        shared_lock<shared_mutex> lock(usersMutex);
+        array<size_t, 3> roleCount{};
+        for (const User& user : users) {
+            if (user.getRole() != UserRole::Invalid) roleCount[size_t(user.getRole())]++;
+        }
+        timer.touched(users.size());
+        string out;
+        for (size_t r = 0; r < roleCount.size(); ++r) {
+            out += VALID_ROLES[r] + "s: " + to_string(roleCount[r]) + "\n";
+        }
+        return out;
+    }
+
+    string formatRequestsSummary() const {
+        OperationTimer timer(metrics, Operation::RequestsSummary);
+        shared_lock<shared_mutex> lock(requestsMutex);
+        map<string, size_t> statusCount;
+        array<size_t, 3> archived = archive.countByStatus();
+        for (size_t i = 0; i < REQUEST_STATUSES.size(); ++i) statusCount[REQUEST_STATUSES[i]] = archived[i];
+        for (const BloodRequest& req : bloodRequests) {
+            statusCount[req.getStatus()]++;
+        }
+        timer.touched(bloodRequests.size() + archived[1] + archived[2]);
+        string out;
+        for (const auto& pair : statusCount) {
+            out += pair.first + ": " + to_string(pair.second) + "\n";
+        }
+        return out;
+    }
+
+    string formatMetrics() const {
+        return metrics.format();
+    }
+
+    // Newest first, after flushing entries still queued for the log file.
+    vector<string> readActivityLog(const LogQuery& q) {
+        if (loggerStrategy) loggerStrategy->flush();
+        return ActivityLogReader::tail(q);
+    }
+
+private:
+    // Stock usable for a recipient type: the exact type only, or every
+    // compatible type when substitution is allowed.
+    int availableFor(BloodType recipient, bool allowSubstitution) const {
+        if (recipient == BloodType::Invalid) return 0;
+        if (!allowSubstitution) return bloodTypeTotals[size_t(recipient)];
+        int total = 0;
+        for (size_t d = 0; d < BLOOD_TYPE_COUNT; ++d) {
+            if (COMPATIBLE_DONORS[size_t(recipient)] & (1u << d)) total += bloodTypeTotals[d];
+        }
+        return total;
+    }
+
+    // A single type as a lock mask; units of no known type need no lock.
+    static uint32_t typeMask(BloodType type) {
+        return type == BloodType::Invalid ? 0 : 1u << size_t(type);
+    }
+
+    // Types a recipient may draw from, as a bit mask.
+    static uint32_t donorTypesFor(BloodType recipient, bool allowSubstitution) {
+        if (recipient == BloodType::Invalid) return 0;
+        return allowSubstitution ? COMPATIBLE_DONORS[size_t(recipient)] : 1u << size_t(recipient);
+    }
+
+    // Takes quantity for a recipient type, exact type first. Returns false,
+    // taking nothing, if stock is short. Callers hold the locks of every
+    // type in donorTypesFor().
+    bool allocateForRequest(BloodType bloodType, int quantity, bool allowSubstitution, vector<BloodAllocation>& allocated) {
+        if (bloodType == BloodType::Invalid || availableFor(bloodType, allowSubstitution) < quantity) return false;
+        int remaining = quantity;
+        for (uint8_t donor : SUBSTITUTION_ORDER[size_t(bloodType)]) {
+            if (remaining == 0 || donor == 0xFF) break;
+            if (!allowSubstitution && donor != uint8_t(bloodType)) break;
+            int taken = min(remaining, bloodTypeTotals[donor]);
+            if (taken == 0) continue;
+            vector<BloodAllocation> part = allocateOldestFirst(BloodType(donor), taken);
+            allocated.insert(allocated.end(), part.begin(), part.end());
+            remaining -= taken;
+        }
+        return true;
+    }
+
+    // Callers hold requestsMutex exclusively.
+    void finishApproval(BloodRequest& req, const vector<BloodAllocation>& allocated) {
+        string audit;
+        for (const BloodAllocation& a : allocated) {
+            audit += (audit.empty() ? "" : ", ") + to_string(a.quantity) + "ml " + Utility::bloodTypeName(a.type)
+                   + " from Unit #" + to_string(a.unitID) + " (" + Utility::fromDayNumber(a.donationDay) + ")";
+        }
+        req.setStatus("Approved");
+        log("Request approved: " + req.getRequestID() + " [" + audit + "]");
+        journalBloodRequest('U', req);
+    }
+
+    // Compacts and checkpoints the inventory when due. Callers must not
+    // hold inventoryMutex. The exclusive lock is only taken when a
+    // compaction is due, so approvals keep overlapping otherwise.
+    void maintainInventory() {
+        checkpointBloodInventoryIfNeeded();
+        {
+            shared_lock<shared_mutex> lock(inventoryMutex);
+            if (!compactionDue()) return;
+        }
+        unique_lock<shared_mutex> lock(inventoryMutex);
+        compactInventoryIfNeeded();
+    }
+
+    // Takes quantity of the given type from the oldest donations first.
+    // The caller must have checked bloodTypeTotals.
+    vector<BloodAllocation> allocateOldestFirst(BloodType bloodType, int quantity) {
+        vector<BloodAllocation> allocations;
+        size_t type = size_t(bloodType);
+        set<UnitKey>& index = unitsByType[type];
+        while (quantity > 0) {
+            auto oldest = firstUsableUnit(index);
+            if (oldest == index.end() || get<0>(*oldest)) break;
+            size_t pos = get<2>(*oldest);
+            int unitQty = bloodInventory.quantityAt(pos);
+            int taken = min(unitQty, quantity);
+            bloodInventory.setQuantityAt(pos, unitQty - taken);
+            bloodTypeTotals[type] -= taken;
+            quantity -= taken;
+            allocations.push_back({bloodInventory.idAt(pos), bloodType, get<1>(*oldest), taken});
+            if (taken == unitQty) {
+                // Drained: move it behind the units with stock, reusing the node.
+                auto node = index.extract(oldest);
+                get<0>(node.value()) = true;
+                index.insert(move(node));
+            }
+            journalBloodUnitUpdate(pos);
+        }
+        return allocations;
+    }
+
+    // Undated units never expire and sort first; after them, allocation
+    // starts at the oldest unexpired donation.
+    set<UnitKey>::iterator firstUsableUnit(set<UnitKey>& index) const {
+        auto first = index.begin();
+        if (first != index.end() && !get<0>(*first) && get<1>(*first) == INVALID_DAY) return first;
+        return index.lower_bound({false, oldestUsableDay, 0});
+    }
+
+    static RequestRow requestRow(const BloodRequest& req, size_t pos) {
+        return {Utility::toDayNumber(req.getRequestDate()), Utility::requestNumber(req.getRequestID()), pos};
+    }
+
+    void addBloodRequest(BloodRequest req) {
+        size_t pos = bloodRequests.size();
+        requestIndex.emplace(req.getRequestID(), pos);
+        requestsByRequestor[req.getRequestorID()].push_back(pos);
+        requestsByDay.insert(requestRow(req, pos));
+        bloodRequests.push_back(move(req));
+    }
+
+    // Walks the date-ordered unit indexes newest first, merging the
+    // stocked and drained parts of each type's index (of every index when
+    // no type is given), and stops once the page is full. Rows before the
+    // date range are never visited, nor drained rows for in-stock queries.
+    QueryPage queryInventory(const InventoryQuery& q) const {
+        using Index = set<UnitKey>;
+        struct Cursor { Index::const_iterator begin, pos; };
+        QueryPage page;
+        if (q.fromDay > q.toDay) return page;
+        uint32_t donorID = StringPool::NONE;
+        if (!q.donorName.empty()) {
+            donorID = bloodInventory.findDonorID(q.donorName);
+            if (donorID == StringPool::NONE) return page;
+        }
+
+        vector<Cursor> cursors;
+        auto addCursor = [&](const Index& index) {
+            for (bool drained : {false, true}) {
+                if (drained && q.inStockOnly) break;
+                Cursor c{index.lower_bound({drained, q.fromDay, 0}), index.upper_bound({drained, q.toDay, UINT32_MAX})};
+                if (c.pos != c.begin) cursors.push_back(c);
+            }
+        };
+        if (q.type != BloodType::Invalid) {
+            addCursor(unitsByType[size_t(q.type)]);
+        } else {
+            for (const Index& index : unitsByType) addCursor(index);
+        }
+
+        size_t skipped = 0;
+        while (!cursors.empty()) {
+            size_t best = 0;
+            auto newer = [](const UnitKey& a, const UnitKey& b) {
+                return tie(get<1>(a), get<2>(a)) < tie(get<1>(b), get<2>(b));
+            };
+            for (size_t c = 1; c < cursors.size(); ++c) {
+                if (newer(*prev(cursors[best].pos), *prev(cursors[c].pos))) best = c;
+            }
+            size_t slot = get<2>(*--cursors[best].pos);
+            if (cursors[best].pos == cursors[best].begin) cursors.erase(cursors.begin() + best);
+            if (donorID != StringPool::NONE && bloodInventory.donorIDAt(slot) != donorID) continue;
+            if (q.inStockOnly && (bloodInventory.quantityAt(slot) <= 0 || isExpired(slot))) continue;
+            if (skipped < q.offset) { ++skipped; continue; }
+            if (page.rows.size() == q.limit) { page.more = true; break; }
+            page.rows.push_back(slot);
+        }
+        return page;
+    }
+
+    // Newest first, over the table and, unless only pending requests are
+    // wanted, the archive. Each side yields at most the rows the page
+    // needs; archived rows carry RequestArchive::ROW_BIT.
+    QueryPage queryRequests(const RequestQuery& q) const {
+        QueryPage page;
+        if (q.fromDay > q.toDay) return page;
+        size_t wanted = q.limit >= SIZE_MAX - q.offset ? SIZE_MAX : q.offset + q.limit + 1;
+        vector<RequestRow> matches = queryOpenRequests(q, wanted);
+        if (Utility::toUpper(q.status) != "PENDING") {
+            size_t open = matches.size();
+            archive.query(q, wanted, matches);
+            if (open > 0 && matches.size() > open) {
+                inplace_merge(matches.begin(), matches.begin() + open, matches.end(), greater<RequestRow>());
+            }
+        }
+        for (size_t i = q.offset; i < matches.size(); ++i) {
+            if (page.rows.size() == q.limit) { page.more = true; break; }
+            page.rows.push_back(get<2>(matches[i]));
+        }
+        return page;
+    }
+
+    // Up to `wanted` (day, number, position) rows from the table, newest first. A
+    // requestor filter starts from that requestor's requests; otherwise
+    // the date index bounds the scan.
+    vector<RequestRow> queryOpenRequests(const RequestQuery& q, size_t wanted) const {
+        vector<RequestRow> found;
+        string status = Utility::toUpper(q.status);
+        // Returns false once enough rows are found.
+        auto visit = [&](const RequestRow& row) {
+            const BloodRequest& req = bloodRequests[get<2>(row)];
+            if (!status.empty() && Utility::toUpper(req.getStatus()) != status) return true;
+            if (q.type != BloodType::Invalid && Utility::toBloodType(req.getBloodType()) != q.type) return true;
+            found.push_back(row);
+            return found.size() < wanted;
+        };
+
+        if (!q.requestorID.empty()) {
+            auto it = requestsByRequestor.find(q.requestorID);
+            if (it == requestsByRequestor.end()) return found;
+            vector<RequestRow> matches;
+            for (size_t pos : it->second) {
+                RequestRow row = requestRow(bloodRequests[pos], pos);
+                if (get<0>(row) >= q.fromDay && get<0>(row) <= q.toDay) matches.push_back(row);
+            }
+            sort(matches.rbegin(), matches.rend());
+            for (const auto& match : matches) {
+                if (!visit(match)) break;
+            }
+        } else {
+            auto begin = requestsByDay.lower_bound({q.fromDay, INT32_MIN, 0});
+            for (auto it = requestsByDay.upper_bound({q.toDay, INT32_MAX, SIZE_MAX}); it != begin;) {
+                if (!visit(*--it)) break;
+            }
+        }
+        return found;
+    }
+
+    static constexpr const char* UNIT_ROW_HEADER = "Unit ID    Type  Quantity    Donated     Donor\n";
+    static constexpr const char* REQUEST_ROW_HEADER = "Request ID   Requestor    Type  Quantity    Requested   Status\n";
+
+    void appendUnitRow(string& out, size_t slot) const {
+        char buf[64];
+        string type = Utility::bloodTypeName(bloodInventory.typeAt(slot));
+        snprintf(buf, sizeof(buf), "%-10u %-5s %5d ml  %-10s  ", unsigned(bloodInventory.idAt(slot)),
+                 type.empty() ? "?" : type.c_str(), bloodInventory.quantityAt(slot),
+                 Utility::fromDayNumber(bloodInventory.donationDayAt(slot)).c_str());
+        out += buf;
+        out += bloodInventory.donorNameAt(slot);
+        if (isExpired(slot)) out += "  [expired]";
+        out += '\n';
+    }
+
+    static void appendRequestRow(string& out, const BloodRequest& req) {
+        char buf[96];
+        snprintf(buf, sizeof(buf), "%-12s %-12s %-5s %5d ml  %-10s  ", req.getRequestID().c_str(),
+                 req.getRequestorID().c_str(), req.getBloodType().c_str(), req.getQuantity(),
+                 req.getRequestDate().c_str());
+        out += buf;
+        out += req.getStatus();
+        out += '\n';
+    }
+
+    // Renders a page into one buffer and writes it with a single call.
+    template <typename AppendRow>
+    string renderPage(const QueryPage& page, size_t offset, const char* header, AppendRow appendRow) const {
+        string out = header;
+        for (size_t row : page.rows) appendRow(out, row);
+        if (page.rows.empty()) return out + "No results.\n";
+        out += "Showing " + to_string(offset + 1) + "-" + to_string(offset + page.rows.size());
+        out += page.more ? " (more available)\n" : "\n";
+        return out;
+    }
+
+    // Callers hold requestsMutex exclusively.
+    string generateRequestID() {
+        markDirty(REQUEST_ID_TABLE);
+        return "REQ" + to_string(requestIDCounter++);
+    }
+
+    void indexUsers(vector<User>&& loaded) {
+        unique_lock<shared_mutex> lock(usersMutex);
+        users.reserve(users.size() + loaded.size());
+        userIndex.reserve(users.size() + loaded.size());
+        for (User& user : loaded) {
+            userIndex.emplace(user.getUserID(), users.size());
+            users.push_back(move(user));
+        }
     }
 
+    static bool parseUser(string_view line, User& user) {
+        array<string_view, 6> tokens;
+        size_t count = Utility::splitView(line, '|', tokens);
+        if (count < 5) return false;
+        BloodType type = count == 6 ? Utility::toBloodType(tokens[5]) : BloodType::Invalid;
+        user = User(string(tokens[0]), string(tokens[1]), string(tokens[2]), string(tokens[3]),
+                    Utility::toUserRole(tokens[4]), type);
+        return true;
+    }
 
-    static bool isValidDate(const string& date) {
-        if (date.size() != 10) return false;
-        if (date[4] != '-' || date[7] != '-') return false;
-        string yearStr = date.substr(0,4);
-        string monthStr = date.substr(5,2);
-        string dayStr = date.substr(8,2);
+    void loadUsers() {
+        OperationTimer timer(metrics, Operation::LoadUsers);
+        if (BinarySnapshot::isFresh(USERS_SNAPSHOT_FILE, USERS_FILE) && loadUsersSnapshot()) {
+            timer.touched(users.size(), Utility::fileSize(USERS_SNAPSHOT_FILE));
+            return;
+        }
+        MappedFile file(USERS_FILE);
+        indexUsers(MappedFile::parseLines<User>(file.text(), parseUser));
+        timer.touched(users.size(), Utility::fileSize(USERS_FILE));
+    }
 
-        if (!all_of(yearStr.begin(), yearStr.end(), ::isdigit)) return false;
-        if (!all_of(monthStr.begin(), monthStr.end(), ::isdigit)) return false;
-        if (!all_of(dayStr.begin(), dayStr.end(), ::isdigit)) return false;
+    bool saveUsers() {
+        OperationTimer timer(metrics, Operation::SaveUsers);
+        shared_lock<shared_mutex> lock(usersMutex);
+        AtomicFileWriter file(USERS_FILE);
+        for (const User& user : users) {
+            file << user.getUserID() << '|' << user.getName() << '|' << user.getContact() << '|' << user.getPassword() << '|' << user.getRoleName();
+            if (user.isDonor()) file << '|' << user.getBloodType();
+            file << '\n';
+        }
+        if (!file.commit()) return false;
+        if (binarySnapshots) saveUsersSnapshot();
+        timer.touched(users.size(), savedBytes(USERS_FILE, USERS_SNAPSHOT_FILE));
+        return true;
+    }
 
-        int year = stoi(yearStr);
-        int month = stoi(monthStr);
-        int day = stoi(dayStr);
+    // Size of a table just written: the text file plus its snapshot, if any.
+    uint64_t savedBytes(const string& textPath, const string& snapshotPath) const {
+        return Utility::fileSize(textPath) + (binarySnapshots ? Utility::fileSize(snapshotPath) : 0);
+    }
 
-        if (year < 1900 || year > 2100) return false;
-        if (month < 1 || month > 12) return false;
+    bool loadUsersSnapshot() {
+        MappedFile file(USERS_SNAPSHOT_FILE);
+        BinaryReader in(nullptr, 0);
+        uint32_t count = 0;
+        if (!BinarySnapshot::open(file, BinarySnapshot::Users, count, in)) return false;
+        vector<User> loaded;
+        loaded.reserve(count);
+        for (uint32_t i = 0; i < count && in.ok(); ++i) {
+            string id = in.getString();
+            string name = in.getString();
+            string contact = in.getString();
+            string pass = in.getString();
+            UserRole role = Utility::toUserRole(in.getString());
+            BloodType bloodType = Utility::toBloodType(in.getString());
+            loaded.emplace_back(id, name, contact, pass, role, bloodType);
+        }
+        if (!in.ok()) return false;
+        indexUsers(move(loaded));
+        return true;
+    }
 
+    void saveUsersSnapshot() {
+        BinaryWriter out;
+        for (const User& user : users) {
+            out.putString(user.getUserID());
+            out.putString(user.getName());
+            out.putString(user.getContact());
+            out.putString(user.getPassword());
+            out.putString(user.getRoleName());
+            out.putString(user.getBloodType());
+        }
+        BinarySnapshot::write(USERS_SNAPSHOT_FILE, BinarySnapshot::Users, uint32_t(users.size()), out);
+    }
 
-        int daysInMonth[] = {31,28,31,30,31,30,31,31,30,31,30,31};
-        if ((year%4==0 && year%100!=0) || (year%400==0)) daysInMonth[1] = 29;
+    // type|quantity|date|donor|unitID
+    string formatBloodUnit(size_t slot) const {
+        BloodUnit unit = bloodInventory.get(slot);
+        return unit.getBloodType() + "|" + to_string(unit.getQuantity()) + "|" + unit.getDonationDate()
+             + "|" + unit.getDonorName() + "|" + to_string(bloodInventory.idAt(slot));
+    }
 
-        if (day < 1 || day > daysInMonth[month-1]) return false;
+    static bool parseBloodUnit(const string_view* fields, BloodUnit& unit) {
+        int qty;
+        if (!Utility::parseInt(fields[1], qty)) return false;
+        unit = BloodUnit(string(fields[0]), qty, string(fields[2]), string(fields[3]));
         return true;
     }
 
+    static string formatBloodRequest(const BloodRequest& req) {
+        return req.getRequestID() + "|" + req.getRequestorID() + "|" + req.getBloodType() + "|"
+             + to_string(req.getQuantity()) + "|" + req.getRequestDate() + "|" + req.getStatus();
+    }
 
-    static void pause() {
-        cout << "Press Enter to continue...";
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    static bool parseBloodRequest(string_view line, BloodRequest& req) {
+        array<string_view, 6> tokens;
+        int qty;
+        if (Utility::splitView(line, '|', tokens) != 6 || !Utility::parseInt(tokens[3], qty)) return false;
+        req = BloodRequest(string(tokens[0]), string(tokens[1]), string(tokens[2]), qty,
+                           string(tokens[4]), string(tokens[5]));
+        return true;
     }
 
+    void loadBloodInventory() {
+        OperationTimer timer(metrics, Operation::LoadInventory);
+        bool fromSnapshot = BinarySnapshot::isFresh(BLOOD_SNAPSHOT_FILE, BLOOD_FILE) && loadBloodInventorySnapshot();
+        if (!fromSnapshot) {
+            MappedFile file(BLOOD_FILE);
+            vector<UnitFields> units = MappedFile::parseLines<UnitFields>(file.text(), [this](string_view line, UnitFields& unit) {
+                array<string_view, 5> tokens;
+                size_t count = Utility::splitView(line, '|', tokens);
+                return (count == 4 || count == 5) && parseBloodUnitFields(tokens.data(), count, unit)
+                    && isStorableUnit(unit.type, unit.donationDay, line);
+            });
+            bloodInventory.reserve(units.size());
+            for (const UnitFields& unit : units) appendBloodUnit(unit);
+        }
+        inventoryJournal.replay([this](char op, const string& payload) { applyBloodUnitRecord(op, payload); });
+        compactInventoryIfNeeded();
+        timer.touched(bloodInventory.liveCount(), Utility::fileSize(fromSnapshot ? BLOOD_SNAPSHOT_FILE : BLOOD_FILE)
+                                                  + Utility::fileSize(BLOOD_JOURNAL_FILE));
+    }
 
-    static bool isNumeric(const string& s) {
-        return !s.empty() && all_of(s.begin(), s.end(), ::isdigit);
+    void applyBloodUnitRecord(char op, string_view payload) {
+        array<string_view, 5> tokens;
+        size_t count = Utility::splitView(payload, '|', tokens);
+        int unitID;
+        if (op == 'I') {
+            UnitFields unit;
+            if (count == 5 && parseBloodUnitFields(tokens.data(), count, unit)
+                && isStorableUnit(unit.type, unit.donationDay, payload)) {
+                appendBloodUnit(unit);
+            }
+        } else if (op == 'U' && count == 5 && Utility::parseInt(tokens[4], unitID)) {
+            size_t slot = bloodInventory.findSlot(uint32_t(unitID));
+            BloodUnit unit;
+            if (slot != BloodInventoryStore::NO_SLOT && parseBloodUnit(tokens.data(), unit)
+                && isStorableUnit(Utility::toBloodType(unit.getBloodType()), Utility::toDayNumber(unit.getDonationDate()), payload)) {
+                replaceBloodUnitRecord(slot, unit);
+            }
+        } else if (op == 'D' && count == 1 && Utility::parseInt(tokens[0], unitID)) {
+            size_t slot = bloodInventory.findSlot(uint32_t(unitID));
+            if (slot != BloodInventoryStore::NO_SLOT) tombstoneBloodUnitRecord(slot);
+        }
     }
 
+    size_t addBloodUnitRecord(const BloodUnit& unit) {
+        size_t slot = bloodInventory.push_back(unit);
+        indexBloodUnit(slot);
+        return slot;
+    }
 
-    static bool isValidBloodType(const string& bt) {
-        string upperBT = toUpper(bt);
-        return find(VALID_BLOOD_TYPES.begin(), VALID_BLOOD_TYPES.end(), upperBT) != VALID_BLOOD_TYPES.end();
+    // A unit's text fields (type, quantity, date, donor and, in the current
+    // format, unit ID) decoded without building a BloodUnit. The donor
+    // name points into the line it came from.
+    struct UnitFields {
+        BloodType type = BloodType::Invalid;
+        int quantity = 0;
+        int32_t donationDay = INVALID_DAY;
+        string_view donor;
+        uint32_t unitID = 0;
+    };
+
+    static bool parseBloodUnitFields(const string_view* fields, size_t count, UnitFields& unit) {
+        int unitID = 0;
+        if (!Utility::parseInt(fields[1], unit.quantity)) return false;
+        if (count == 5 && !Utility::parseInt(fields[4], unitID)) return false;
+        unit.type = Utility::toBloodType(fields[0]);
+        unit.donationDay = Utility::toDayNumber(fields[2]);
+        unit.donor = fields[3];
+        unit.unitID = uint32_t(unitID);
+        return true;
     }
 
+    // The store keeps types and dates decoded, so a row with an unknown
+    // type or a bad date would be saved back with that field blank. Such
+    // rows are skipped, with a note in the activity log.
+    bool isStorableUnit(BloodType type, int32_t day, string_view row) {
+        if (type != BloodType::Invalid && day != INVALID_DAY) return true;
+        log("Skipped inventory row with an invalid blood type or date: " + string(row));
+        return false;
+    }
 
-    static bool isValidRole(const string& role) {
-        return find(VALID_ROLES.begin(), VALID_ROLES.end(), role) != VALID_ROLES.end();
+    void appendBloodUnit(const UnitFields& unit) {
+        size_t slot = bloodInventory.push_back(unit.type, unit.quantity, unit.donationDay, unit.donor, unit.unitID);
+        indexBloodUnit(slot);
     }
 
+    void replaceBloodUnitRecord(size_t slot, const BloodUnit& unit) {
+        unindexBloodUnit(slot);
+        bloodInventory.set(slot, unit);
+        indexBloodUnit(slot);
+    }
 
-    static string getCurrentDate() {
-        time_t t = time(nullptr);
-        tm* now = localtime(&t);
-        char buf[11];
-        snprintf(buf, sizeof(buf), "%04d-%02d-%02d", now->tm_year+1900, now->tm_mon+1, now->tm_mday);
-        return string(buf);
+    void tombstoneBloodUnitRecord(size_t slot) {
+        unindexBloodUnit(slot);
+        bloodInventory.tombstone(slot);
     }
 
+    // Drops deleted and drained units from memory and disk once they make
+    // up a quarter of the store.
+    void compactInventoryIfNeeded() {
+        if (!compactionDue()) return;
+        size_t removed = bloodInventory.compact();
+        rebuildUnitIndexes();
+        if (!persistenceDeferred) requestCommit(INVENTORY_TABLE);
+        log("Inventory compacted: " + to_string(removed) + " empty or deleted units removed");
+    }
 
-    static vector<string> split(const string& s, char delimiter) {
-        vector<string> tokens;
-        string token;
-        istringstream tokenStream(s);
-        while (getline(tokenStream, token, delimiter)) {
-            tokens.push_back(token);
-        }
-        return tokens;
+    bool compactionDue() const {
+        size_t reclaimable = bloodInventory.reclaimableCount();
+        return reclaimable >= INVENTORY_COMPACTION_MIN && reclaimable >= bloodInventory.size() / 4;
     }
-};
 
+    static size_t unitIndexFor(BloodType type) {
+        return type == BloodType::Invalid ? BLOOD_TYPE_COUNT : size_t(type);
+    }
 
-class LoggerStrategy {
-public:
-    virtual ~LoggerStrategy() {}
-    virtual void log(const string& message) = 0;
-};
+    // Units without a valid donation date never expire.
+    bool isExpired(size_t slot) const {
+        int32_t day = bloodInventory.donationDayAt(slot);
+        return day != INVALID_DAY && day < oldestUsableDay;
+    }
 
-class FileLogger : public LoggerStrategy {
-    ofstream logFile;
-public:
-    FileLogger() { logFile.open(ACTIVITY_LOG_FILE, ios::app); }
-    ~FileLogger() { if (logFile.is_open()) logFile.close(); }
-    void log(const string& message) override {
-        if (logFile.is_open()) logFile << "[" << Utility::getCurrentDate() << "] " << message << endl;
+    // The key depends on the quantity, so callers unindex a unit before
+    // changing it and index it again afterwards.
+    UnitKey unitKey(size_t slot) const {
+        return {bloodInventory.quantityAt(slot) <= 0, bloodInventory.donationDayAt(slot), uint32_t(slot)};
     }
-};
 
-class ConsoleLogger : public LoggerStrategy {
-public:
-    void log(const string& message) override {
-        cout << "[LOG] " << message << endl;
+    void unindexBloodUnit(size_t slot) {
+        BloodType type = bloodInventory.typeAt(slot);
+        if (!bloodInventory.isLive(slot)) return;
+        unitsByType[unitIndexFor(type)].erase(unitKey(slot));
+        if (type == BloodType::Invalid || isExpired(slot)) return;
+        bloodTypeTotals[size_t(type)] -= bloodInventory.quantityAt(slot);
     }
-};
 
+    void indexBloodUnit(size_t pos) {
+        BloodType type = bloodInventory.typeAt(pos);
+        if (!bloodInventory.isLive(pos)) return;
+        unitsByType[unitIndexFor(type)].insert(unitKey(pos));
+        if (type == BloodType::Invalid || isExpired(pos)) return;
+        bloodTypeTotals[size_t(type)] += bloodInventory.quantityAt(pos);
+    }
 
-class User {
-protected:
-    string userID;
-    string name;
-    string contact;
-    string password;
-    string role;
+    // Moves the expiry cutoff up to today and takes the units that crossed
+    // it out of available stock. Indexes are ordered by donation day, and
+    // so by expiry, so only the newly expired units are visited.
+    void sweepExpiredUnits() {
+        int32_t cutoff = Utility::today() - SHELF_LIFE_DAYS + 1;
+        if (cutoff <= oldestUsableDay) return;
+        OperationTimer timer(metrics, Operation::ExpirySweep);
+        unique_lock<shared_mutex> lock(inventoryMutex);
+        size_t expired = 0;
+        int expiredQuantity = 0;
+        int32_t previousCutoff = max(int32_t(oldestUsableDay), INVALID_DAY + 1);
+        for (size_t t = 0; t < BLOOD_TYPE_COUNT; ++t) {
+            auto& index = unitsByType[t];
+            auto last = index.lower_bound({false, cutoff, 0});
+            for (auto it = index.lower_bound({false, previousCutoff, 0}); it != last; ++it, ++expired) {
+                bloodTypeTotals[t] -= bloodInventory.quantityAt(get<2>(*it));
+                expiredQuantity += bloodInventory.quantityAt(get<2>(*it));
+            }
+        }
+        oldestUsableDay = cutoff;
+        timer.touched(expired);
+        if (expired) {
+            log("Expired " + to_string(expired) + " units (" + to_string(expiredQuantity) + " ml) donated before "
+                + Utility::fromDayNumber(cutoff));
+        }
+    }
 
-public:
-    User(const string& id, const string& name, const string& contact, const string& password, const string& role)
-        : userID(id), name(name), contact(contact), password(password), role(role) {}
+    void rebuildUnitIndexes() {
+        for (auto& index : unitsByType) index.clear();
+        bloodTypeTotals.fill(0);
+        for (size_t i = 0; i < bloodInventory.size(); ++i) indexBloodUnit(i);
+    }
 
-    virtual ~User() {}
+    void journalBloodUnitInsert(size_t pos) {
+        if (persistenceDeferred) return;
+        inventoryJournal.append('I', formatBloodUnit(pos));
+    }
 
-    string getUserID() const { return userID; }
-    string getName() const { return name; }
-    string getContact() const { return contact; }
-    string getPassword() const { return password; }
-    string getRole() const { return role; }
+    void journalBloodUnitUpdate(size_t pos) {
+        if (persistenceDeferred) return;
+        inventoryJournal.append('U', formatBloodUnit(pos));
+    }
 
-    void setName(const string& n) { name = n; }
-    void setContact(const string& c) { contact = c; }
-    void setPassword(const string& p) { password = p; }
+    void journalBloodUnitDelete(uint32_t unitID) {
+        if (persistenceDeferred) return;
+        inventoryJournal.append('D', to_string(unitID));
+    }
 
-    virtual void displayUserInfo() const {
-        cout << "UserID: " << userID << "\nName: " << name << "\nContact: " << contact << "\nRole: " << role << "\n";
+    void checkpointBloodInventoryIfNeeded() {
+        if (inventoryJournal.size() >= JOURNAL_CHECKPOINT_THRESHOLD) requestCommit(INVENTORY_TABLE);
     }
 
-    bool authenticate(const string& pass) const {
-        return password == pass;
+    // The journal is only cleared once the table it folds into is safely
+    // on disk.
+    bool checkpointBloodInventory() {
+        if (!saveBloodInventory()) return false;
+        inventoryJournal.reset();
+        return true;
     }
-};
 
+    bool saveBloodInventory() {
+        OperationTimer timer(metrics, Operation::SaveInventory);
+        AtomicFileWriter file(BLOOD_FILE);
+        for (size_t i = 0; i < bloodInventory.size(); ++i) {
+            if (bloodInventory.isLive(i)) file << formatBloodUnit(i) << '\n';
+        }
+        if (!file.commit()) return false;
+        if (binarySnapshots) saveBloodInventorySnapshot();
+        timer.touched(bloodInventory.liveCount(), savedBytes(BLOOD_FILE, BLOOD_SNAPSHOT_FILE));
+        return true;
+    }
 
-class Donor : public User {
-private:
-    string bloodType;
+    bool loadBloodInventorySnapshot() {
+        MappedFile file(BLOOD_SNAPSHOT_FILE);
+        BinaryReader in(nullptr, 0);
+        uint32_t count = 0;
+        if (!BinarySnapshot::open(file, BinarySnapshot::Inventory, count, in)) return false;
+        if (!bloodInventory.readBinary(in, count)) {
+            bloodInventory.clear();
+            return false;
+        }
+        rebuildUnitIndexes();
+        return true;
+    }
 
-public:
-    Donor(const string& id, const string& name, const string& contact, const string& password, const string& bloodType)
-        : User(id, name, contact, password, "Donor"), bloodType(bloodType) {}
+    void saveBloodInventorySnapshot() {
+        BinaryWriter out;
+        bloodInventory.writeBinary(out);
+        BinarySnapshot::write(BLOOD_SNAPSHOT_FILE, BinarySnapshot::Inventory, uint32_t(bloodInventory.liveCount()), out);
+    }
 
-    string getBloodType() const { return bloodType; }
-    void setBloodType(const string& bt) { bloodType = bt; }
+    void loadBloodRequests() {
+        OperationTimer timer(metrics, Operation::LoadRequests);
+        bool fromSnapshot = BinarySnapshot::isFresh(REQUESTS_SNAPSHOT_FILE, REQUESTS_FILE) && loadBloodRequestsSnapshot();
+        if (!fromSnapshot) {
+            MappedFile file(REQUESTS_FILE);
+            vector<BloodRequest> loaded = MappedFile::parseLines<BloodRequest>(file.text(), parseBloodRequest);
+            bloodRequests.reserve(loaded.size());
+            requestIndex.reserve(loaded.size());
+            for (BloodRequest& req : loaded) addBloodRequest(move(req));
+        }
+        requestsJournal.replay([this](char op, const string& payload) { applyBloodRequestRecord(op, payload); });
+        // Requests finalized since the last checkpoint, or every finished
+        // request of a table older than the archive, move out at the next
+        // commit.
+        bool finalized = any_of(bloodRequests.begin(), bloodRequests.end(),
+                                [](const BloodRequest& req) { return req.getStatus() != "Pending"; });
+        if (finalized) requestCommit(REQUESTS_TABLE);
+        timer.touched(bloodRequests.size(), Utility::fileSize(fromSnapshot ? REQUESTS_SNAPSHOT_FILE : REQUESTS_FILE)
+                                            + Utility::fileSize(REQUESTS_JOURNAL_FILE));
+    }
 
-    void displayUserInfo() const override {
-        User::displayUserInfo();
-        cout << "Blood Type: " << bloodType << "\n";
+    void applyBloodRequestRecord(char op, string_view payload) {
+        BloodRequest req;
+        if (!parseBloodRequest(payload, req)) return;
+        if (op == 'I') {
+            addBloodRequest(req);
+        } else if (op == 'U') {
+            auto it = requestIndex.find(req.getRequestID());
+            if (it == requestIndex.end()) return;
+            BloodRequest& existing = bloodRequests[it->second];
+            if (existing.getRequestDate() != req.getRequestDate()) {
+                requestsByDay.erase(requestRow(existing, it->second));
+                requestsByDay.insert(requestRow(req, it->second));
+            }
+            existing = req;
+        }
     }
-};
 
+    void journalBloodRequest(char op, const BloodRequest& req) {
+        if (persistenceDeferred) return;
+        requestsJournal.append(op, formatBloodRequest(req));
+        if (requestsJournal.size() >= JOURNAL_CHECKPOINT_THRESHOLD) requestCommit(REQUESTS_TABLE);
+    }
 
-class BloodUnit {
-private:
-    string bloodType;
-    int quantity;
-    string donationDate;
-    string donorName; 
+    // Callers hold requestsMutex exclusively. Finalized requests reach the
+    // archive before the table is rewritten without them.
+    bool checkpointBloodRequests() {
+        if (!archiveFinalizedRequests()) return false;
+        if (!saveBloodRequests()) return false;
+        requestsJournal.reset();
+        return true;
+    }
 
-public:
-    BloodUnit() : bloodType(""), quantity(0), donationDate(""), donorName("") {}
-    BloodUnit(const string& bt, int qty, const string& date, const string& donor)
-        : bloodType(bt), quantity(qty), donationDate(date), donorName(donor) {}
+    bool archiveFinalizedRequests() {
+        vector<BloodRequest> finalized;
+        for (const BloodRequest& req : bloodRequests) {
+            if (req.getStatus() != "Pending") finalized.push_back(req);
+        }
+        if (finalized.empty()) return true;
+        // Archived IDs are never rescanned by loadRequestIDCounter().
+        if (!saveRequestIDCounter() || !archive.append(finalized)) return false;
+        vector<BloodRequest> open;
+        open.reserve(bloodRequests.size() - finalized.size());
+        for (BloodRequest& req : bloodRequests) {
+            if (req.getStatus() == "Pending") open.push_back(move(req));
+        }
+        bloodRequests.clear();
+        requestIndex.clear();
+        requestsByRequestor.clear();
+        requestsByDay.clear();
+        for (BloodRequest& req : open) addBloodRequest(move(req));
+        log("Archived " + to_string(finalized.size()) + " finalized requests");
+        return true;
+    }
 
-    string getBloodType() const { return bloodType; }
-    int getQuantity() const { return quantity; }
-    string getDonationDate() const { return donationDate; }
-    string getDonorName() const { return donorName; } 
+    bool saveBloodRequests() {
+        OperationTimer timer(metrics, Operation::SaveRequests);
+        AtomicFileWriter file(REQUESTS_FILE);
+        for (const BloodRequest& req : bloodRequests) {
+            file << formatBloodRequest(req) << '\n';
+        }
+        if (!file.commit()) return false;
+        if (binarySnapshots) saveBloodRequestsSnapshot();
+        timer.touched(bloodRequests.size(), savedBytes(REQUESTS_FILE, REQUESTS_SNAPSHOT_FILE));
+        return true;
+    }
 
-    void setBloodType(const string& bt) { bloodType = bt; }
-    void setQuantity(int qty) { quantity = qty; }
-    void setDonationDate(const string& date) { donationDate = date; }
-    void setDonorName(const string& donor) { donorName = donor; } 
+    bool loadBloodRequestsSnapshot() {
+        MappedFile file(REQUESTS_SNAPSHOT_FILE);
+        BinaryReader in(nullptr, 0);
+        uint32_t count = 0;
+        if (!BinarySnapshot::open(file, BinarySnapshot::Requests, count, in)) return false;
+        vector<BloodRequest> loaded;
+        loaded.reserve(count);
+        for (uint32_t i = 0; i < count && in.ok(); ++i) {
+            string reqID = in.getString();
+            string reqorID = in.getString();
+            string bloodType = in.getString();
+            int qty = in.get<int32_t>();
+            string reqDate = in.getString();
+            string status = in.getString();
+            loaded.emplace_back(reqID, reqorID, bloodType, qty, reqDate, status);
+        }
+        if (!in.ok()) return false;
+        for (const BloodRequest& req : loaded) addBloodRequest(req);
+        return true;
+    }
 
-    void displayBloodInfo() const {
-        cout << "Blood Type: " << bloodType << "\nQuantity: " << quantity
-             << "\nDonation Date: " << donationDate
-             << "\nDonor Name: " << donorName << "\n"; 
+    void saveBloodRequestsSnapshot() {
+        BinaryWriter out;
+        for (const BloodRequest& req : bloodRequests) {
+            out.putString(req.getRequestID());
+            out.putString(req.getRequestorID());
+            out.putString(req.getBloodType());
+            out.put(int32_t(req.getQuantity()));
+            out.putString(req.getRequestDate());
+            out.putString(req.getStatus());
+        }
+        BinarySnapshot::write(REQUESTS_SNAPSHOT_FILE, BinarySnapshot::Requests, uint32_t(bloodRequests.size()), out);
     }
-};
 
+    // Callers hold requestsMutex.
+    bool saveRequestIDCounter() {
+        AtomicFileWriter file(REQUEST_ID_FILE);
+        file << to_string(requestIDCounter);
+        return file.commit();
+    }
 
-class BloodRequest {
-private:
-    string requestID;
-    string requestorID;
-    string bloodType;
-    int quantity;
-    string requestDate;
-    string status; 
+    // A change that still has to reach its table file. Tables with a
+    // journal are only marked once their checkpoint is due.
+    void markDirty(uint32_t tables) {
+        dirtyTables.fetch_or(tables);
+        if (pendingChanges.fetch_add(1) + 1 >= GROUP_COMMIT_THRESHOLD) requestCommit(0);
+    }
 
-public:
-    BloodRequest() : requestID(""), requestorID(""), bloodType(""), quantity(0), requestDate(""), status("Pending") {}
-    BloodRequest(const string& reqID, const string& reqorID, const string& bt, int qty, const string& date, const string& stat = "Pending")
-        : requestID(reqID), requestorID(reqorID), bloodType(bt), quantity(qty), requestDate(date), status(stat) {}
+    // Wakes the commit thread now rather than at the next interval.
+    void requestCommit(uint32_t tables) {
+        dirtyTables.fetch_or(tables);
+        {
+            lock_guard<mutex> lock(commitSignalMutex);
+            commitDue = true;
+        }
+        commitSignal.notify_one();
+    }
 
-    string getRequestID() const { return requestID; }
-    string getRequestorID() const { return requestorID; }
-    string getBloodType() const { return bloodType; }
-    int getQuantity() const { return quantity; }
-    string getRequestDate() const { return requestDate; }
-    string getStatus() const { return status; }
+    // Writes every dirty table in one group, the request ID counter along
+    // with the requests. A table that fails to write stays dirty and is
+    // retried by the next commit.
+    void commitDirty() {
+        lock_guard<mutex> commitLock(commitMutex);
+        pendingChanges = 0;
+        uint32_t tables = dirtyTables.exchange(0);
+        if (!tables) return;
+        OperationTimer timer(metrics, Operation::Commit);
+        uint32_t failed = 0;
+        if ((tables & USERS_TABLE) && !saveUsers()) failed |= USERS_TABLE;
+        if (tables & (REQUESTS_TABLE | REQUEST_ID_TABLE)) {
+            unique_lock<shared_mutex> lock(requestsMutex);
+            if ((tables & REQUESTS_TABLE) && !checkpointBloodRequests()) failed |= REQUESTS_TABLE;
+            if (!saveRequestIDCounter()) failed |= REQUEST_ID_TABLE;
+        }
+        if (tables & INVENTORY_TABLE) {
+            unique_lock<shared_mutex> lock(inventoryMutex);
+            if (!checkpointBloodInventory()) failed |= INVENTORY_TABLE;
+        }
+        if (failed) {
+            dirtyTables.fetch_or(failed);
+            log("Commit failed; will retry (tables " + to_string(failed) + ")");
+        }
+        timer.touched(bitset<32>(tables).count());
+    }
 
-    void setStatus(const string& s) { status = s; }
-    void setQuantity(int q) { quantity = q; }
+    void commitLoop() {
+        unique_lock<mutex> lock(commitSignalMutex);
+        while (!stopCommitting) {
+            commitSignal.wait_for(lock, GROUP_COMMIT_INTERVAL, [this] { return stopCommitting || commitDue; });
+            commitDue = false;
+            lock.unlock();
+            commitDirty();
+            sweepExpiredUnits();
+            lock.lock();
+        }
+    }
 
-    void displayRequestInfo() const {
-        cout << "Request ID: " << requestID << "\nRequestor ID: " << requestorID << "\nBlood Type: " << bloodType
-             << "\nQuantity: " << quantity << "\nRequest Date: " << requestDate << "\nStatus: " << status << "\n";
+    void stopCommitThread() {
+        {
+            lock_guard<mutex> lock(commitSignalMutex);
+            stopCommitting = true;
+        }
+        commitSignal.notify_one();
+        if (commitThread.joinable()) commitThread.join();
+    }
+
+    // Never hands out an ID already in the requests table, even when the
+    // counter file is older than the journal. The counter is saved before
+    // any request is archived, so the archive needs no scan.
+    void loadRequestIDCounter() {
+        ifstream file(REQUEST_ID_FILE);
+        if (file.is_open()) {
+            file >> requestIDCounter;
+            file.close();
+        }
+        for (const BloodRequest& req : bloodRequests) {
+            requestIDCounter = max(requestIDCounter, Utility::requestNumber(req.getRequestID()) + 1);
+        }
     }
 };
 
+thread_local string BloodBankCore::actor;
+
 
+// Console front end over BloodBankCore: the interactive menus, batch
+// scripts and the server's line protocol. Holds no bank state of its own
+// beyond who is logged in at the console.
 class BloodBankSystem {
 private:
     static BloodBankSystem* instance;
-    BloodBankSystem() : currentUser(nullptr), requestIDCounter(1000) {
-        setLoggerStrategy(new FileLogger());
-        loadUsers();
-        loadBloodInventory();
-        loadBloodRequests();
-        loadRequestIDCounter();
-    }
-
-    ~BloodBankSystem() {
-        saveAllData();
-        for (User* user : users) delete user;
-        users.clear();
-        if (loggerStrategy) delete loggerStrategy;
-    }
-
-    vector<User*> users;
-    vector<BloodUnit> bloodInventory;
-    vector<BloodRequest> bloodRequests;
+    static mutex instanceMutex;
+    BloodBankSystem() {}
 
-    User* currentUser;
-    LoggerStrategy* loggerStrategy = nullptr;
-    int requestIDCounter = 1000;
+    BloodBankCore core;
+    // A copy of the logged-in user; refreshed after profile updates.
+    User currentUser;
 
 public:
     static BloodBankSystem* getInstance() {
+        lock_guard<mutex> lock(instanceMutex);
         if (!instance) {
             instance = new BloodBankSystem();
         }
         return instance;
     }
 
-    void setLoggerStrategy(LoggerStrategy* strategy) {
-        if (loggerStrategy) delete loggerStrategy;
-        loggerStrategy = strategy;
+    static void destroyInstance() {
+        lock_guard<mutex> lock(instanceMutex);
+        delete instance;
+        instance = nullptr;
     }
 
-    void log(const string& msg) {
-        if (loggerStrategy) loggerStrategy->log(msg);
+    BloodBankCore& getCore() {
+        return core;
+    }
+
+    // Runs one line of the server protocol for a client and returns the
+    // reply: any output lines, then a line starting with OK or ERR. Safe
+    // to call from several threads at once.
+    string executeSessionCommand(ClientSession& session, string_view line) {
+        BloodBankCore::setActor(session.userID);
+        string reply = runSessionCommand(session, line);
+        BloodBankCore::setActor("");
+        return reply;
+    }
+
+    // Executes a script of '|'-separated commands, one per line:
+    //   add-unit|<type>|<ml>|<YYYY-MM-DD>|<donor name>
+    //   donate|<donor userID>|<ml>
+    //   request|<requestor userID>|<type>|<ml>|<YYYY-MM-DD>
+    //   approve|<requestID>[|substitute]
+    //   approve-all[|substitute]
+    //   reject|<requestID>
+    //   query-units[|type][|from][|to][|donor][|offset][|limit]
+    //   query-requests[|status][|requestor][|type][|from][|to][|offset][|limit]
+    // Blank lines and lines starting with '#' are skipped. Nothing is
+    // journaled while the script runs; all tables are saved once at the end.
+    // Returns the number of failed commands.
+    int runBatch(const string& path) {
+        error_code ec;
+        if (!filesystem::exists(path, ec)) {
+            cout << "Batch file not found: " << path << "\n";
+            return 1;
+        }
+        int lineNumber = 0, succeeded = 0, failed = 0;
+        core.deferPersistence();
+        MappedFile::forEachLine(path, [&](string_view line) {
+            lineNumber++;
+            if (line.empty() || line[0] == '#') return;
+            string output;
+            string error = executeBatchCommand(line, output);
+            cout << output;
+            if (error.empty()) {
+                succeeded++;
+            } else {
+                failed++;
+                cout << "Line " << lineNumber << ": " << error << "\n";
+            }
+        });
+        core.resumePersistence();
+        cout << "Batch complete: " << succeeded << " succeeded, " << failed << " failed.\n";
+        core.log("Batch " + path + " executed: " + to_string(succeeded) + " succeeded, " + to_string(failed) + " failed");
+        return failed;
     }
 
     void run() {
@@ -298,10 +3731,12 @@ public:
 
             if (choice == 1) {
                 if (login()) {
-                    log("User " + currentUser->getUserID() + " logged in.");
+                    BloodBankCore::setActor(currentUser.getUserID());
+                    core.log("User " + currentUser.getUserID() + " logged in.");
                     userMenu();
-                    log("User " + currentUser->getUserID() + " logged out.");
-                    currentUser = nullptr;
+                    core.log("User " + currentUser.getUserID() + " logged out.");
+                    BloodBankCore::setActor("");
+                    currentUser = User();
                 }
             } else if (choice == 2) {
                 registerUser();
@@ -313,6 +3748,13 @@ public:
     }
 
 private:
+    static constexpr const char* SERVER_HELP =
+        "Commands ('|'-separated):\n"
+        "  login|<userID>|<password>   logout   quit   help   inventory\n"
+        "  Donor:     donate|<ml>\n"
+        "  Requestor: request|<type>|<ml>[|YYYY-MM-DD]   my-requests[|offset][|limit]\n"
+        "  Admin:     reports   shutdown   and every batch command (add-unit, approve,\n"
+        "             approve-all, reject, query-units, query-requests, ...)\n";
 
     bool login() {
         string id, pass;
@@ -321,12 +3763,9 @@ private:
         cout << "Enter Password: ";
         getline(cin, pass);
 
-        for (User* user : users) {
-            if (user->getUserID() == id && user->authenticate(pass)) {
-                currentUser = user;
-                cout << "Login successful! Welcome, " << currentUser->getName() << " (" << currentUser->getRole() << ").\n";
-                return true;
-            }
+        if (core.authenticateUser(id, pass, currentUser)) {
+            cout << "Login successful! Welcome, " << currentUser.getName() << " (" << currentUser.getRoleName() << ").\n";
+            return true;
         }
         cout << "Login failed. Invalid UserID or Password.\n";
         return false;
@@ -343,7 +3782,7 @@ private:
                 cout << "UserID cannot be empty.\n";
                 continue;
             }
-            if (find_if(users.begin(), users.end(), [&](User* u){return u->getUserID() == id;}) != users.end()) {
+            if (core.hasUser(id)) {
                 cout << "UserID already exists. Try another.\n";
                 continue;
             }
@@ -381,8 +3820,8 @@ private:
         int roleChoice = getValidatedChoice(1,3);
         string role = VALID_ROLES[roleChoice - 1];
 
+        string bloodType;
         if (role == "Donor") {
-            string bloodType;
             while (true) {
                 cout << "Enter Blood Type (A+, A-, B+, B-, AB+, AB-, O+, O-): ";
                 getline(cin, bloodType);
@@ -390,31 +3829,20 @@ private:
                 if (Utility::isValidBloodType(bloodType)) break;
                 cout << "Invalid blood type. Try again.\n";
             }
-            users.push_back(new Donor(id, name, contact, pass1, bloodType));
-        } else {
-            users.push_back(new User(id, name, contact, pass1, role));
         }
-        cout << "User registered successfully!\n";
-        log("New user registered: " + id + " Role: " + role);
-        saveUsers();
+        OperationResult result = core.addUser(id, name, contact, pass1, role, bloodType);
+        cout << (result == OperationResult::Ok ? "User registered successfully!" : describeResult(result)) << "\n";
     }
 
-
     void userMenu() {
-        if (!currentUser) return;
-
-        if (currentUser->getRole() == "Admin") {
-            adminMenu();
-        } else if (currentUser->getRole() == "Donor") {
-            donorMenu();
-        } else if (currentUser->getRole() == "Requestor") {
-            requestorMenu();
-        } else {
-            cout << "Unknown role. Logging out.\n";
+        switch (currentUser.getRole()) {
+            case UserRole::Admin: adminMenu(); break;
+            case UserRole::Donor: donorMenu(); break;
+            case UserRole::Requestor: requestorMenu(); break;
+            default: cout << "Unknown role. Logging out.\n";
         }
     }
 
-
     void adminMenu() {
         while (true) {
             cout << "\n--- Admin Menu ---\n";
@@ -439,22 +3867,19 @@ private:
             int choice = getValidatedChoice(1,5);
 
             if (choice == 1) {
-                if (users.empty()) {
-                    cout << "No users found.\n";
-                } else {
-                    for (User* user : users) {
-                        user->displayUserInfo();
-                        cout << "------------------\n";
-                    }
-                }
+                size_t count = core.forEachUser([](const User& user) {
+                    user.displayUserInfo();
+                    cout << "------------------\n";
+                });
+                if (count == 0) cout << "No users found.\n";
                 Utility::pause();
             } else if (choice == 2) {
                 registerUser();
             } else if (choice == 3) {
                 cout << "Enter UserID to update: ";
                 string id; getline(cin, id);
-                User* user = findUserByID(id);
-                if (!user) {
+                User user;
+                if (!core.findUser(id, user)) {
                     cout << "User not found.\n";
                     Utility::pause();
                     continue;
@@ -463,9 +3888,8 @@ private:
             } else if (choice == 4) {
                 cout << "Enter UserID to delete: ";
                 string id; getline(cin, id);
-                if (deleteUser(id)) {
+                if (core.deleteUser(id) == OperationResult::Ok) {
                     cout << "User deleted.\n";
-                    log("User deleted: " + id);
                 } else {
                     cout << "User not found.\n";
                 }
@@ -476,89 +3900,53 @@ private:
         }
     }
 
-    User* findUserByID(const string& id) {
-        for (User* u : users) {
-            if (u->getUserID() == id) return u;
-        }
-        return nullptr;
-    }
-
-    void updateUser(User* user) {
-        cout << "Updating user " << user->getUserID() << "\n";
+    void updateUser(const User& user) {
+        cout << "Updating user " << user.getUserID() << "\n";
         cout << "Leave input blank to keep current value.\n";
 
-        cout << "Current Name: " << user->getName() << "\nNew Name: ";
-        string input; getline(cin, input);
-        if (!input.empty()) user->setName(input);
-
-        cout << "Current Contact: " << user->getContact() << "\nNew Contact: ";
-        getline(cin, input);
-        input = Utility::trim(input);
-        if (!input.empty()) {
-            if (Utility::isNumeric(input)) {
-                user->setContact(input);
-            } else {
-                cout << "Contact must be numeric. Keeping previous.\n";
-            }
-        }
-
+        cout << "Current Name: " << user.getName() << "\nNew Name: ";
+        string name; getline(cin, name);
 
-        if (user->getRole() == "Donor") {
-            Donor* donor = dynamic_cast<Donor*>(user);
-            if (donor) {
-                cout << "Current Blood Type: " << donor->getBloodType() << "\nNew Blood Type: ";
-                getline(cin, input);
-                input = Utility::toUpper(Utility::trim(input));
-                if (!input.empty()) {
-                    if (Utility::isValidBloodType(input)) {
-                        donor->setBloodType(input);
-                    } else {
-                        cout << "Invalid blood type entered. Keeping previous.\n";
-                    }
-                }
-            }
+        cout << "Current Contact: " << user.getContact() << "\nNew Contact: ";
+        string contact; getline(cin, contact);
+        contact = Utility::trim(contact);
+        if (!contact.empty() && !Utility::isNumeric(contact)) {
+            cout << "Contact must be numeric. Keeping previous.\n";
+            contact.clear();
         }
-        cout << "User updated successfully.\n";
-        log("User updated: " + user->getUserID());
-        saveUsers();
-        Utility::pause();
-    }
 
-    bool deleteUser(const string& id) {
-        for (auto it = users.begin(); it != users.end(); ++it) {
-            if ((*it)->getUserID() == id) {
-                delete *it;
-                users.erase(it);
-                saveUsers();
-                return true;
+        string bloodType;
+        if (user.isDonor()) {
+            cout << "Current Blood Type: " << user.getBloodType() << "\nNew Blood Type: ";
+            getline(cin, bloodType);
+            bloodType = Utility::toUpper(Utility::trim(bloodType));
+            if (!bloodType.empty() && !Utility::isValidBloodType(bloodType)) {
+                cout << "Invalid blood type entered. Keeping previous.\n";
+                bloodType.clear();
             }
         }
-        return false;
+        OperationResult result = core.updateUser(user.getUserID(), name, contact, bloodType);
+        cout << (result == OperationResult::Ok ? "User updated successfully." : describeResult(result)) << "\n";
+        Utility::pause();
     }
 
     void manageBloodInventory() {
         while (true) {
             cout << "\n--- Manage Blood Inventory ---\n";
-            cout << "1. View Blood Inventory\n2. Add Blood Unit\n3. Update Blood Unit\n4. Delete Blood Unit\n5. Back\n";
-            int choice = getValidatedChoice(1,5);
+            cout << "1. View Blood Inventory\n2. Add Blood Unit\n3. Update Blood Unit\n4. Delete Blood Unit\n"
+                    "5. Search Inventory\n6. Back\n";
+            int choice = getValidatedChoice(1,6);
 
             if (choice == 1) {
-                if (bloodInventory.empty()) {
-                    cout << "Blood inventory is empty.\n";
-                } else {
-                    for (size_t i = 0; i < bloodInventory.size(); ++i) {
-                        cout << "Record #" << (i+1) << "\n";
-                        bloodInventory[i].displayBloodInfo();
-                        cout << "------------------\n";
-                    }
-                }
-                Utility::pause();
+                browseUnits(InventoryQuery(), "Blood inventory is empty.");
             } else if (choice == 2) {
                 addBloodUnit();
             } else if (choice == 3) {
                 updateBloodUnit();
             } else if (choice == 4) {
                 deleteBloodUnit();
+            } else if (choice == 5) {
+                searchBloodInventory();
             } else {
                 break;
             }
@@ -599,23 +3987,23 @@ private:
         cout << "Enter Donor Name: ";
         getline(cin, donorName);
 
-        bloodInventory.emplace_back(bloodType, quantity, date, donorName);
-        cout << "Blood unit added successfully.\n";
-        log("Blood unit added: " + bloodType + " Qty: " + to_string(quantity) + " Donor: " + donorName);
-        saveBloodInventory();
+        uint32_t unitID = 0;
+        OperationResult result = core.addUnit(bloodType, quantity, date, donorName, &unitID);
+        if (result == OperationResult::Ok) cout << "Blood unit #" << unitID << " added successfully.\n";
+        else cout << describeResult(result) << "\n";
         Utility::pause();
     }
 
     void updateBloodUnit() {
-        if (bloodInventory.empty()) {
+        if (core.inventoryEmpty()) {
             cout << "No blood units to update.\n";
             Utility::pause();
             return;
         }
-        cout << "Enter record number to update (1 to " << bloodInventory.size() << "): ";
-        int rec = getValidatedChoice(1, bloodInventory.size());
-        BloodUnit& unit = bloodInventory[rec - 1];
-        cout << "Updating blood unit #" << rec << "\n";
+        BloodUnit unit;
+        uint32_t unitID = promptBloodUnit("update", unit);
+        if (unitID == 0) return;
+        cout << "Updating blood unit #" << unitID << "\n";
 
         cout << "Current Blood Type: " << unit.getBloodType() << "\nNew Blood Type: ";
         string input; getline(cin, input);
@@ -643,145 +4031,400 @@ private:
             unit.setDonorName(input);
         }
 
-        cout << "Blood unit updated.\n";
-        log("Blood unit updated: Record #" + to_string(rec));
-        saveBloodInventory();
+        OperationResult result = core.updateUnit(unitID, unit);
+        if (result == OperationResult::Ok) cout << "Blood unit updated.\n";
+        else cout << (result == OperationResult::NotFound ? "Blood unit not found." : describeResult(result)) << "\n";
+        Utility::pause();
+    }
+
+    // Returns the unit's ID, or 0 (no unit has it) if there is no such unit.
+    uint32_t promptBloodUnit(const string& action, BloodUnit& unit) {
+        cout << "Enter Unit ID to " << action << ": ";
+        string input; getline(cin, input);
+        int unitID = 0;
+        if (Utility::parseInt(Utility::trim(input), unitID) && unitID > 0 && core.findUnit(uint32_t(unitID), unit)) {
+            return uint32_t(unitID);
+        }
+        cout << "Blood unit not found.\n";
         Utility::pause();
+        return 0;
     }
 
     void deleteBloodUnit() {
-        if (bloodInventory.empty()) {
+        if (core.inventoryEmpty()) {
             cout << "No blood units to delete.\n";
             Utility::pause();
             return;
         }
-        cout << "Enter record number to delete (1 to " << bloodInventory.size() << "): ";
-        int rec = getValidatedChoice(1, bloodInventory.size());
-        bloodInventory.erase(bloodInventory.begin() + (rec - 1));
-        cout << "Blood unit deleted.\n";
-        log("Blood unit deleted: Record #" + to_string(rec));
-        saveBloodInventory();
+        BloodUnit unit;
+        uint32_t unitID = promptBloodUnit("delete", unit);
+        if (unitID == 0) return;
+        cout << (core.deleteUnit(unitID) == OperationResult::Ok ? "Blood unit deleted.\n" : "Blood unit not found.\n");
         Utility::pause();
     }
 
     void manageBloodRequests() {
         while (true) {
             cout << "\n--- Manage Blood Requests ---\n";
-            cout << "1. View All Requests\n2. Approve Request\n3. Reject Request\n4. Back\n";
-            int choice = getValidatedChoice(1,4);
+            cout << "1. View All Requests\n2. Approve Request\n3. Reject Request\n4. Approve All Feasible Pending\n"
+                    "5. Search Requests\n6. Back\n";
+            int choice = getValidatedChoice(1,6);
 
             if (choice == 1) {
-                if (bloodRequests.empty()) {
-                    cout << "No blood requests found.\n";
-                } else {
-                    for (const BloodRequest& req : bloodRequests) {
-                        req.displayRequestInfo();
-                        cout << "------------------\n";
-                    }
-                }
-                Utility::pause();
+                browseRequests(RequestQuery(), "No blood requests found.");
             } else if (choice == 2) {
                 approveRequest();
             } else if (choice == 3) {
                 rejectRequest();
+            } else if (choice == 4) {
+                approveAllFeasible();
+            } else if (choice == 5) {
+                searchBloodRequests();
             } else {
                 break;
             }
         }
     }
 
+    void approveAllFeasible() {
+        cout << "Use compatible substitutes when a type is short? (y/n): ";
+        string answer; getline(cin, answer);
+        BulkApprovalReport report = core.approveAllPending(Utility::toUpper(Utility::trim(answer)) == "Y");
+        cout << "Approved " << report.approved.size() << " request(s):\n";
+        for (const auto& entry : report.approved) {
+            cout << "  " << entry.first << ": " << entry.second << " ml\n";
+        }
+        cout << "Could not fill " << report.shortfalls.size() << " request(s):\n";
+        for (const auto& entry : report.shortfalls) {
+            cout << "  " << entry.first << ": short by " << entry.second << " ml\n";
+        }
+        Utility::pause();
+    }
+
     void approveRequest() {
-        if (bloodRequests.empty()) {
+        if (!core.hasRequests()) {
             cout << "No requests to approve.\n";
             Utility::pause();
             return;
         }
         cout << "Enter Request ID to approve: ";
         string reqID; getline(cin, reqID);
-        BloodRequest* req = findRequestByID(reqID);
-        if (!req) {
-            cout << "Request not found.\n";
-            Utility::pause();
-            return;
-        }
-        if (req->getStatus() != "Pending") {
-            cout << "Request is already " << req->getStatus() << ".\n";
-            Utility::pause();
-            return;
-        }
-
-        int totalQty = 0;
-        for (const BloodUnit& unit : bloodInventory) {
-            if (unit.getBloodType() == req->getBloodType()) {
-                totalQty += unit.getQuantity();
+        vector<BloodAllocation> allocations;
+        OperationResult result = core.approve(reqID, &allocations);
+        BloodRequest req;
+        if (result == OperationResult::InsufficientStock && core.findRequest(reqID, req)
+            && core.availableStock(Utility::toBloodType(req.getBloodType()), true) >= req.getQuantity()) {
+            cout << "Not enough " << req.getBloodType() << " in stock, but compatible types can cover it.\n";
+            cout << "Use compatible substitutes? (y/n): ";
+            string answer; getline(cin, answer);
+            if (Utility::toUpper(Utility::trim(answer)) == "Y") {
+                result = core.approve(reqID, &allocations, true);
             }
         }
-        if (totalQty < req->getQuantity()) {
-            cout << "Insufficient blood quantity in inventory.\n";
-            Utility::pause();
-            return;
-        }
-
-        int qtyToDeduct = req->getQuantity();
-        for (BloodUnit& unit : bloodInventory) {
-            if (unit.getBloodType() == req->getBloodType()) {
-                if (unit.getQuantity() >= qtyToDeduct) {
-                    unit.setQuantity(unit.getQuantity() - qtyToDeduct);
-                    qtyToDeduct = 0;
-                    break;
-                } else {
-                    qtyToDeduct -= unit.getQuantity();
-                    unit.setQuantity(0);
-                }
+        if (result == OperationResult::Ok) {
+            cout << "Request approved. Allocated (oldest first):\n";
+            for (const BloodAllocation& a : allocations) {
+                cout << "  Unit #" << a.unitID << " " << Utility::bloodTypeName(a.type) << " donated "
+                     << Utility::fromDayNumber(a.donationDay) << ": " << a.quantity << " ml\n";
             }
+        } else {
+            printRequestError(result, reqID);
         }
-
-        req->setStatus("Approved");
-        cout << "Request approved.\n";
-        log("Request approved: " + reqID);
-        saveBloodInventory();
-        saveBloodRequests();
         Utility::pause();
     }
 
     void rejectRequest() {
-        if (bloodRequests.empty()) {
+        if (!core.hasRequests()) {
             cout << "No requests to reject.\n";
             Utility::pause();
             return;
         }
         cout << "Enter Request ID to reject: ";
         string reqID; getline(cin, reqID);
-        BloodRequest* req = findRequestByID(reqID);
-        if (!req) {
+        OperationResult result = core.reject(reqID);
+        if (result == OperationResult::Ok) {
+            cout << "Request rejected.\n";
+        } else {
+            printRequestError(result, reqID);
+        }
+        Utility::pause();
+    }
+
+    static string describeResult(OperationResult result) {
+        switch (result) {
+            case OperationResult::Ok: return "OK.";
+            case OperationResult::NotFound: return "Not found.";
+            case OperationResult::NotPending: return "Request is not pending.";
+            case OperationResult::InsufficientStock: return "Insufficient blood quantity in inventory.";
+            case OperationResult::InvalidInput: return "Invalid input.";
+            case OperationResult::NotDonor: return "Only donors can donate blood.";
+            case OperationResult::AlreadyExists: return "UserID already exists.";
+        }
+        return "";
+    }
+
+    // Returns an error message, or an empty string on success. Anything the
+    // command prints is appended to out.
+    string executeBatchCommand(string_view line, string& out) {
+        array<string_view, 8> fields;
+        size_t count = Utility::splitView(line, '|', fields);
+        string command(fields[0]);
+        int quantity = 0;
+
+        if (command == "add-unit") {
+            if (count != 5) return "Usage: add-unit|<type>|<ml>|<YYYY-MM-DD>|<donor name>";
+            string bloodType = Utility::toUpper(Utility::trim(string(fields[1])));
+            string date(fields[3]);
+            if (!Utility::isValidBloodType(bloodType)) return "Invalid blood type.";
+            if (!Utility::parseInt(fields[2], quantity) || quantity <= 0) return "Invalid quantity.";
+            if (!Utility::isValidDate(date)) return "Invalid date.";
+            OperationResult result = core.addUnit(bloodType, quantity, date, string(fields[4]));
+            if (result != OperationResult::Ok) return describeResult(result);
+        } else if (command == "donate") {
+            if (count != 3) return "Usage: donate|<donor userID>|<ml>";
+            if (!Utility::parseInt(fields[2], quantity) || quantity <= 0) return "Invalid quantity.";
+            OperationResult result = core.donate(string(fields[1]), quantity);
+            if (result != OperationResult::Ok) return string(fields[1]) + ": " + describeResult(result);
+        } else if (command == "request") {
+            if (count != 5) return "Usage: request|<requestor userID>|<type>|<ml>|<YYYY-MM-DD>";
+            string requestorID(fields[1]);
+            string bloodType = Utility::toUpper(Utility::trim(string(fields[2])));
+            string date(fields[4]);
+            if (!Utility::isValidBloodType(bloodType)) return "Invalid blood type.";
+            if (!Utility::parseInt(fields[3], quantity) || quantity <= 0) return "Invalid quantity.";
+            if (!Utility::isValidDate(date)) return "Invalid date.";
+            OperationResult result = core.submitRequest(requestorID, bloodType, quantity, date);
+            if (result != OperationResult::Ok) return requestorID + ": " + describeResult(result);
+        } else if (command == "approve") {
+            if (count != 2 && !(count == 3 && fields[2] == "substitute")) return "Usage: approve|<requestID>[|substitute]";
+            string reqID(fields[1]);
+            OperationResult result = core.approve(reqID, nullptr, count == 3);
+            if (result != OperationResult::Ok) return reqID + ": " + describeResult(result);
+        } else if (command == "approve-all") {
+            if (count != 1 && !(count == 2 && fields[1] == "substitute")) return "Usage: approve-all[|substitute]";
+            BulkApprovalReport report = core.approveAllPending(count == 2);
+            out += "approve-all: " + to_string(report.approved.size()) + " approved, "
+                 + to_string(report.shortfalls.size()) + " short\n";
+        } else if (command == "reject") {
+            if (count != 2) return "Usage: reject|<requestID>";
+            string reqID(fields[1]);
+            OperationResult result = core.reject(reqID);
+            if (result != OperationResult::Ok) return reqID + ": " + describeResult(result);
+        } else if (command == "query-units") {
+            InventoryQuery q;
+            if (count > 7 || !parseQueryOptional(fields, count, 1, q.type) || !parseQueryOptional(fields, count, 2, q.fromDay)
+                || !parseQueryOptional(fields, count, 3, q.toDay) || !parseQueryPaging(fields, count, 5, q.offset, q.limit)) {
+                return "Usage: query-units[|type][|from][|to][|donor][|offset][|limit]";
+            }
+            if (count > 4) q.donorName = string(fields[4]);
+            QueryPage page;
+            out += core.renderInventoryPage(q, page);
+        } else if (command == "query-requests") {
+            RequestQuery q;
+            if (count > 8 || !parseQueryOptional(fields, count, 3, q.type) || !parseQueryOptional(fields, count, 4, q.fromDay)
+                || !parseQueryOptional(fields, count, 5, q.toDay) || !parseQueryPaging(fields, count, 6, q.offset, q.limit)) {
+                return "Usage: query-requests[|status][|requestor][|type][|from][|to][|offset][|limit]";
+            }
+            if (count > 1) q.status = string(fields[1]);
+            if (count > 2) q.requestorID = string(fields[2]);
+            QueryPage page;
+            out += core.renderRequestPage(q, page);
+        } else {
+            return "Unknown command: " + command;
+        }
+        return "";
+    }
+
+    string runSessionCommand(ClientSession& session, string_view line) {
+        array<string_view, 8> fields;
+        size_t count = Utility::splitView(line, '|', fields);
+        string command(fields[0]);
+        if (command == "help") return string(SERVER_HELP) + "OK\n";
+        if (command == "quit") {
+            session.closeRequested = true;
+            return "OK Goodbye\n";
+        }
+        if (command == "login") {
+            if (count != 3) return "ERR Usage: login|<userID>|<password>\n";
+            User user;
+            if (!core.authenticateUser(string(fields[1]), string(fields[2]), user)) return "ERR Invalid UserID or Password.\n";
+            session.userID = user.getUserID();
+            BloodBankCore::setActor(session.userID);
+            core.log("User " + session.userID + " logged in.");
+            return "OK Welcome, " + user.getName() + " (" + user.getRoleName() + ")\n";
+        }
+
+        User user;
+        if (session.userID.empty() || !core.findUser(session.userID, user)) return "ERR Not logged in.\n";
+        UserRole role = user.getRole();
+        string out;
+        int quantity = 0;
+        if (command == "logout") {
+            core.log("User " + session.userID + " logged out.");
+            session.userID.clear();
+            return "OK\n";
+        } else if (command == "inventory") {
+            return core.formatInventorySummary() + "OK\n";
+        } else if (role == UserRole::Donor && command == "donate") {
+            if (count != 2 || !Utility::parseInt(fields[1], quantity) || quantity <= 0) return "ERR Usage: donate|<ml>\n";
+            OperationResult result = core.donate(session.userID, quantity);
+            if (result != OperationResult::Ok) return "ERR " + describeResult(result) + "\n";
+            return "OK Thank you for your donation!\n";
+        } else if (role == UserRole::Requestor && command == "request") {
+            string bloodType = count > 1 ? Utility::toUpper(Utility::trim(string(fields[1]))) : "";
+            string date = count == 4 ? string(fields[3]) : Utility::getCurrentDate();
+            if (count != 3 && count != 4) return "ERR Usage: request|<type>|<ml>[|YYYY-MM-DD]\n";
+            if (!Utility::isValidBloodType(bloodType)) return "ERR Invalid blood type.\n";
+            if (!Utility::parseInt(fields[2], quantity) || quantity <= 0) return "ERR Invalid quantity.\n";
+            if (!Utility::isValidDate(date)) return "ERR Invalid date.\n";
+            string reqID;
+            OperationResult result = core.submitRequest(session.userID, bloodType, quantity, date, &reqID);
+            if (result != OperationResult::Ok) return "ERR " + describeResult(result) + "\n";
+            return "OK Request submitted: " + reqID + "\n";
+        } else if (role == UserRole::Requestor && command == "my-requests") {
+            RequestQuery q;
+            q.requestorID = user.getUserID();
+            if (count > 3 || !parseQueryPaging(fields, count, 1, q.offset, q.limit)) return "ERR Usage: my-requests[|offset][|limit]\n";
+            QueryPage page;
+            return core.renderRequestPage(q, page) + "OK\n";
+        } else if (role != UserRole::Admin) {
+            return "ERR Unknown command for a " + user.getRoleName() + ": " + command + "\n";
+        } else if (command == "reports") {
+            return "Inventory:\n" + core.formatInventorySummary() + "Users:\n" + core.formatUserSummary()
+                 + "Requests:\n" + core.formatRequestsSummary() + "OK\n";
+        } else if (command == "shutdown") {
+            session.shutdownRequested = true;
+            core.log("Server shutdown requested.");
+            return "OK Shutting down\n";
+        }
+        string error = executeBatchCommand(line, out);
+        return out + (error.empty() ? "OK\n" : "ERR " + error + "\n");
+    }
+
+    void printRequestError(OperationResult result, const string& reqID) {
+        if (result == OperationResult::NotFound) {
             cout << "Request not found.\n";
-            Utility::pause();
-            return;
+        } else if (result == OperationResult::NotPending) {
+            BloodRequest req;
+            core.findRequest(reqID, req);
+            cout << "Request is already " << req.getStatus() << ".\n";
+        } else if (result == OperationResult::InsufficientStock) {
+            cout << "Insufficient blood quantity in inventory.\n";
         }
-        if (req->getStatus() != "Pending") {
-            cout << "Request is already " << req->getStatus() << ".\n";
-            Utility::pause();
-            return;
+    }
+
+    // Shows a query one page at a time until the results run out or the
+    // user stops.
+    template <typename Query, typename RenderQuery>
+    void browsePages(Query q, RenderQuery renderQuery, const char* emptyMessage) {
+        while (true) {
+            QueryPage page;
+            string text = renderQuery(q, page);
+            if (page.rows.empty()) {
+                cout << emptyMessage << "\n";
+                break;
+            }
+            cout << text;
+            if (!page.more) break;
+            cout << "Show next page? (y/n): ";
+            string answer; getline(cin, answer);
+            if (Utility::toUpper(Utility::trim(answer)) != "Y") return;
+            q.offset += q.limit;
         }
-        req->setStatus("Rejected");
-        cout << "Request rejected.\n";
-        log("Request rejected: " + reqID);
-        saveBloodRequests();
         Utility::pause();
     }
 
-    BloodRequest* findRequestByID(const string& reqID) {
-        for (BloodRequest& req : bloodRequests) {
-            if (req.getRequestID() == reqID) return &req;
+    void browseUnits(const InventoryQuery& q, const char* emptyMessage) {
+        browsePages(q, [this](const InventoryQuery& query, QueryPage& page) { return core.renderInventoryPage(query, page); },
+                    emptyMessage);
+    }
+
+    void browseRequests(const RequestQuery& q, const char* emptyMessage) {
+        browsePages(q, [this](const RequestQuery& query, QueryPage& page) { return core.renderRequestPage(query, page); },
+                    emptyMessage);
+    }
+
+    // Query field parsers shared by the search menus and batch mode. Blank
+    // fields leave the filter open.
+    static bool parseQueryType(string_view field, BloodType& type) {
+        if (field.empty()) return true;
+        type = Utility::toBloodType(Utility::toUpper(string(field)));
+        return type != BloodType::Invalid;
+    }
+
+    static bool parseQueryDay(string_view field, int32_t& day) {
+        if (field.empty()) return true;
+        day = Utility::toDayNumber(field);
+        return day != INVALID_DAY;
+    }
+
+    static bool parseQueryCount(string_view field, size_t& value, bool allowZero) {
+        if (field.empty()) return true;
+        int parsed;
+        if (!Utility::parseInt(field, parsed) || (parsed == 0 && !allowZero)) return false;
+        value = size_t(parsed);
+        return true;
+    }
+
+    // Batch query fields are positional and may be omitted from the end.
+    static bool parseQueryOptional(const array<string_view, 8>& fields, size_t count, size_t i, BloodType& type) {
+        return i >= count || parseQueryType(fields[i], type);
+    }
+
+    static bool parseQueryOptional(const array<string_view, 8>& fields, size_t count, size_t i, int32_t& day) {
+        return i >= count || parseQueryDay(fields[i], day);
+    }
+
+    static bool parseQueryPaging(const array<string_view, 8>& fields, size_t count, size_t first, size_t& offset, size_t& limit) {
+        return (first >= count || parseQueryCount(fields[first], offset, true))
+            && (first + 1 >= count || parseQueryCount(fields[first + 1], limit, false));
+    }
+
+    static string promptQueryField(const string& prompt) {
+        cout << prompt;
+        string input; getline(cin, input);
+        return Utility::trim(input);
+    }
+
+    // Reads the type, date range and page size shared by both searches.
+    static bool promptCommonFilters(BloodType& type, int32_t& fromDay, int32_t& toDay, size_t& limit) {
+        if (!parseQueryType(promptQueryField("Blood type (blank for any): "), type)) {
+            cout << "Invalid blood type.\n";
+        } else if (!parseQueryDay(promptQueryField("From date YYYY-MM-DD (blank for any): "), fromDay)
+                || !parseQueryDay(promptQueryField("To date YYYY-MM-DD (blank for any): "), toDay)) {
+            cout << "Invalid date.\n";
+        } else if (!parseQueryCount(promptQueryField("Results per page (blank for " + to_string(DEFAULT_PAGE_SIZE) + "): "),
+                                    limit, false)) {
+            cout << "Invalid page size.\n";
+        } else {
+            return true;
         }
-        return nullptr;
+        Utility::pause();
+        return false;
+    }
+
+    void searchBloodInventory() {
+        InventoryQuery q;
+        q.donorName = promptQueryField("Donor name (blank for any): ");
+        q.inStockOnly = Utility::toUpper(promptQueryField("Only units with stock left? (y/n): ")) == "Y";
+        if (!promptCommonFilters(q.type, q.fromDay, q.toDay, q.limit)) return;
+        browseUnits(q, "No matching blood units.");
+    }
+
+    void searchBloodRequests() {
+        RequestQuery q;
+        q.status = promptQueryField("Status (Pending/Approved/Rejected, blank for any): ");
+        q.requestorID = promptQueryField("Requestor ID (blank for any): ");
+        if (!promptCommonFilters(q.type, q.fromDay, q.toDay, q.limit)) return;
+        browseRequests(q, "No matching blood requests.");
     }
 
     void viewReports() {
         while (true) {
             cout << "\n--- Reports ---\n";
-            cout << "1. Blood Inventory Summary\n2. User Summary\n3. Requests Summary\n4. Activity Log\n5. Back\n";
-            int choice = getValidatedChoice(1,5);
+            cout << "1. Blood Inventory Summary\n2. User Summary\n3. Requests Summary\n4. Activity Log\n"
+                 << "5. Operation Metrics\n6. Back\n";
+            int choice = getValidatedChoice(1,6);
 
             if (choice == 1) {
                 bloodInventorySummary();
@@ -791,70 +4434,75 @@ private:
                 requestsSummary();
             } else if (choice == 4) {
                 viewActivityLog();
+            } else if (choice == 5) {
+                viewOperationMetrics();
             } else {
                 break;
             }
         }
     }
 
+    void viewOperationMetrics() {
+        cout << "\n--- Operation Metrics (since startup) ---\n" << core.formatMetrics();
+        cout << "Percentiles are histogram bucket bounds. Full histograms are written to " << METRICS_FILE << " at shutdown.\n";
+        Utility::pause();
+    }
+
     void bloodInventorySummary() {
-        cout << "\n--- Blood Inventory Summary ---\n";
-        map<string, int> bloodCount;
-        for (const string& bt : VALID_BLOOD_TYPES) bloodCount[bt] = 0;
-        for (const BloodUnit& unit : bloodInventory) {
-            bloodCount[unit.getBloodType()] += unit.getQuantity();
-        }
-        for (const auto& pair : bloodCount) {
-            cout << pair.first << ": " << pair.second << " ml\n";
-        }
+        cout << "\n--- Blood Inventory Summary ---\n" << core.formatInventorySummary();
         Utility::pause();
     }
 
     void userSummary() {
-        cout << "\n--- User Summary ---\n";
-        map<string, int> roleCount;
-        for (const string& role : VALID_ROLES) roleCount[role] = 0;
-        for (const User* user : users) {
-            roleCount[user->getRole()]++;
-        }
-        for (const auto& pair : roleCount) {
-            cout << pair.first << "s: " << pair.second << "\n";
-        }
+        cout << "\n--- User Summary ---\n" << core.formatUserSummary();
         Utility::pause();
     }
 
     void requestsSummary() {
-        cout << "\n--- Requests Summary ---\n";
-        map<string, int> statusCount;
-        statusCount["Pending"] = 0;
-        statusCount["Approved"] = 0;
-        statusCount["Rejected"] = 0;
-        for (const BloodRequest& req : bloodRequests) {
-            statusCount[req.getStatus()]++;
-        }
-        for (const auto& pair : statusCount) {
-            cout << pair.first << ": " << pair.second << "\n";
-        }
+        cout << "\n--- Requests Summary ---\n" << core.formatRequestsSummary();
         Utility::pause();
     }
 
     void viewActivityLog() {
         cout << "\n--- Activity Log ---\n";
-        log("Displaying activity log.");
+        LogQuery q;
+        if (!parseQueryCount(promptQueryField("Number of entries (blank for " + to_string(DEFAULT_LOG_TAIL) + "): "),
+                             q.limit, false)) {
+            cout << "Invalid number.\n";
+        } else if (!parseQueryDay(promptQueryField("From date YYYY-MM-DD (blank for any): "), q.fromDay)
+                || !parseQueryDay(promptQueryField("To date YYYY-MM-DD (blank for any): "), q.toDay)) {
+            cout << "Invalid date.\n";
+        } else {
+            q.userID = promptQueryField("User ID (blank for any): ");
+            q.keyword = promptQueryField("Action keyword (blank for any): ");
+            vector<string> entries = core.readActivityLog(q);
+            if (entries.empty()) {
+                cout << "No matching log entries.\n";
+            } else {
+                string out;
+                for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+                    out += *it;
+                    out += '\n';
+                }
+                out += "Showing the last " + to_string(entries.size()) + " matching entries.\n";
+                cout << out;
+            }
+            core.log("Activity log viewed.");
+        }
         Utility::pause();
     }
 
-
     void donorMenu() {
         while (true) {
             cout << "\n--- Donor Menu ---\n";
             cout << "1. View My Profile\n2. Update Profile\n3. View Blood Inventory\n4. Donate Blood\n5. Logout\n";
             int choice = getValidatedChoice(1,5);
             if (choice == 1) {
-                currentUser->displayUserInfo();
+                currentUser.displayUserInfo();
                 Utility::pause();
             } else if (choice == 2) {
                 updateUser(currentUser);
+                core.findUser(currentUser.getUserID(), currentUser);
             } else if (choice == 3) {
                 viewBloodInventory();
             } else if (choice == 4) {
@@ -868,14 +4516,12 @@ private:
 
     void donateBlood() {
         cout << "--- Donate Blood ---\n";
-        Donor* donor = dynamic_cast<Donor*>(currentUser);
-        if (!donor) {
+        if (!currentUser.isDonor()) {
             cout << "Error: Only donors can donate blood.\n";
             Utility::pause();
             return;
         }
-        string bloodType = donor->getBloodType();
-        cout << "Your Blood Type: " << bloodType << endl;
+        cout << "Your Blood Type: " << currentUser.getBloodType() << endl;
 
         int quantity;
         while (true) {
@@ -888,48 +4534,28 @@ private:
             cout << "Invalid quantity. Must be positive integer.\n";
         }
 
-        string date = Utility::getCurrentDate();
-        string donorName = donor->getName(); 
-        bloodInventory.emplace_back(bloodType, quantity, date, donorName); 
-        cout << "Thank you for your donation!\n";
-        log("Donor " + donor->getUserID() + " donated " + to_string(quantity) + "ml of " + bloodType);
-        saveBloodInventory();
+        OperationResult result = core.donate(currentUser.getUserID(), quantity);
+        cout << (result == OperationResult::Ok ? "Thank you for your donation!" : describeResult(result)) << "\n";
         Utility::pause();
     }
 
     void viewBloodInventory() {
-    if (bloodInventory.empty()) {
-        cout << "Blood Inventory Is Empty.\n";
-    } else {
-        int totalQty = 0;
-        for (const BloodUnit& unit : bloodInventory) {
-            totalQty += unit.getQuantity();
-        }
-        if (totalQty == 0) {
-            cout << "Blood Inventory Is Empty.\n";
-        } else {
-            for (const BloodUnit& unit : bloodInventory) {
-                if (unit.getQuantity() > 0) {
-                    unit.displayBloodInfo();
-                    cout << "------------------\n";
-                }
-            }
-        }
-    }
-    Utility::pause();
+    InventoryQuery q;
+    q.inStockOnly = true;
+    browseUnits(q, "Blood Inventory Is Empty.");
 }
 
-
     void requestorMenu() {
         while (true) {
             cout << "\n--- Requestor Menu ---\n";
             cout << "1. View My Profile\n2. Update Profile\n3. Make Blood Request\n4. View My Requests\n5. Logout\n";
             int choice = getValidatedChoice(1,5);
             if (choice == 1) {
-                currentUser->displayUserInfo();
+                currentUser.displayUserInfo();
                 Utility::pause();
             } else if (choice == 2) {
                 updateUser(currentUser);
+                core.findUser(currentUser.getUserID(), currentUser);
             } else if (choice == 3) {
                 makeBloodRequest();
             } else if (choice == 4) {
@@ -971,29 +4597,24 @@ private:
             cout << "Invalid date format or value. Try again.\n";
         }
 
-        string reqID = generateRequestID();
-        bloodRequests.emplace_back(reqID, currentUser->getUserID(), bloodType, quantity, date);
-        cout << "Blood request submitted. Request ID: " << reqID << "\n";
-        log("New blood request: " + reqID + " by " + currentUser->getUserID());
-        saveBloodRequests();
+        string reqID;
+        OperationResult result = core.submitRequest(currentUser.getUserID(), bloodType, quantity, date, &reqID);
+        if (result == OperationResult::Ok) cout << "Blood request submitted. Request ID: " << reqID << "\n";
+        else cout << describeResult(result) << "\n";
         Utility::pause();
     }
 
     void viewMyRequests() {
         cout << "--- My Blood Requests ---\n";
-        bool found = false;
-        for (const BloodRequest& req : bloodRequests) {
-            if (req.getRequestorID() == currentUser->getUserID()) {
-                req.displayRequestInfo();
-                cout << "------------------\n";
-                found = true;
-            }
+        vector<BloodRequest> mine = core.requestsBy(currentUser.getUserID());
+        for (const BloodRequest& req : mine) {
+            req.displayRequestInfo();
+            cout << "------------------\n";
         }
-        if (!found) cout << "You have no blood requests.\n";
+        if (mine.empty()) cout << "You have no blood requests.\n";
         Utility::pause();
     }
 
-    
     int getValidatedChoice(int min, int max) {
         while (true) {
             cout << "Enter choice (" << min << "-" << max << "): ";
@@ -1005,126 +4626,563 @@ private:
             cout << "Invalid choice. Try again.\n";
         }
     }
+};
 
-    string generateRequestID() {
-        return "REQ" + to_string(requestIDCounter++);
+BloodBankSystem* BloodBankSystem::instance = nullptr;
+mutex BloodBankSystem::instanceMutex;
+
+
+// Fixed-size worker pool fed from a FIFO task queue. Queued tasks still
+// run when the pool is destroyed; the destructor waits for them.
+class ThreadPool {
+    vector<thread> workers;
+    deque<function<void()>> tasks;
+    mutex tasksMutex;
+    condition_variable available;
+    bool stopping = false;
+
+    void workerLoop() {
+        while (true) {
+            function<void()> task;
+            {
+                unique_lock<mutex> lock(tasksMutex);
+                available.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) return;
+                task = move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
     }
 
-    void loadUsers() {
-        ifstream file(USERS_FILE);
-        if (!file.is_open()) return;
-        string line;
-        while (getline(file, line)) {
+public:
+    explicit ThreadPool(size_t threadCount) {
+        for (size_t i = 0; i < max<size_t>(threadCount, 1); ++i) workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
 
-            vector<string> tokens = Utility::split(line, '|');
-            if (tokens.size() < 5) continue;
-            string id = tokens[0];
-            string name = tokens[1];
-            string contact = tokens[2];
-            string pass = tokens[3];
-            string role = tokens[4];
-            if (role == "Donor" && tokens.size() == 6) {
-                string bloodType = tokens[5];
-                users.push_back(new Donor(id, name, contact, pass, bloodType));
-            } else {
-                users.push_back(new User(id, name, contact, pass, role));
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> lock(tasksMutex);
+            stopping = true;
+        }
+        available.notify_all();
+        for (thread& worker : workers) worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(function<void()> task) {
+        {
+            lock_guard<mutex> lock(tasksMutex);
+            tasks.push_back(move(task));
+        }
+        available.notify_one();
+    }
+};
+
+
+// Line-protocol server on a loopback TCP port. One thread polls every
+// connection and hands complete command lines to the pool, one task per
+// connection at a time so each desk's commands run in order. Idle desks
+// hold no worker; up to workerCount commands run at once. Replies end with
+// an "OK" or "ERR" line.
+class BankServer {
+#ifdef _WIN32
+    using SocketHandle = SOCKET;
+    static constexpr SocketHandle NO_SOCKET = INVALID_SOCKET;
+    static void closeSocket(SocketHandle s) { closesocket(s); }
+    static void shutdownSocket(SocketHandle s) { shutdown(s, SD_BOTH); }
+    static int pollSockets(vector<pollfd>& fds, int timeoutMs) { return WSAPoll(fds.data(), ULONG(fds.size()), timeoutMs); }
+#else
+    using SocketHandle = int;
+    static constexpr SocketHandle NO_SOCKET = -1;
+    static void closeSocket(SocketHandle s) { close(s); }
+    static void shutdownSocket(SocketHandle s) { shutdown(s, SHUT_RDWR); }
+    static int pollSockets(vector<pollfd>& fds, int timeoutMs) { return poll(fds.data(), nfds_t(fds.size()), timeoutMs); }
+#endif
+    static constexpr size_t MAX_LINE = 64 << 10;
+    // A busy connection with this much unread input is not read from
+    // until its commands catch up; the poll timeout rechecks it.
+    static constexpr int POLL_INTERVAL_MS = 100;
+
+    struct Connection {
+        SocketHandle socket;
+        // Only the task running the connection's commands touches it.
+        ClientSession session;
+        mutex inputMutex;
+        // Guarded by inputMutex.
+        string pending;
+        bool busy = false;
+        bool hungUp = false;
+
+        explicit Connection(SocketHandle socket) : socket(socket) {}
+    };
+
+    BloodBankSystem& bank;
+    uint16_t port;
+    size_t workerCount;
+    SocketHandle listener = NO_SOCKET;
+    atomic<bool> stopping{false};
+    mutex clientsMutex;
+    set<SocketHandle> clients;
+
+    static bool sendAll(SocketHandle s, const string& data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+#ifdef MSG_NOSIGNAL
+            int n = int(send(s, data.data() + sent, int(data.size() - sent), MSG_NOSIGNAL));
+#else
+            int n = int(send(s, data.data() + sent, int(data.size() - sent), 0));
+#endif
+            if (n <= 0) return false;
+            sent += size_t(n);
+        }
+        return true;
+    }
+
+    static sockaddr_in loopbackAddress(uint16_t port) {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return addr;
+    }
+
+    // Runs the connection's complete lines in order, then returns the
+    // connection to the poll loop, or closes it once the loop has seen
+    // the peer hang up. Quitting or a failed send shuts the socket down,
+    // which the loop sees as a hang-up.
+    void runCommands(const shared_ptr<Connection>& conn) {
+        ClientSession& session = conn->session;
+        while (true) {
+            string line;
+            {
+                lock_guard<mutex> lock(conn->inputMutex);
+                size_t newline = session.closeRequested ? string::npos : conn->pending.find('\n');
+                if (newline == string::npos) {
+                    if (conn->hungUp) break;
+                    conn->busy = false;
+                    return;
+                }
+                line.assign(conn->pending, 0, newline);
+                conn->pending.erase(0, newline + 1);
             }
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            string reply = line.empty() ? "" : bank.executeSessionCommand(session, line);
+            if (!reply.empty() && !sendAll(conn->socket, reply)) session.closeRequested = true;
+            if (session.shutdownRequested) stop();
+            if (session.closeRequested) shutdownSocket(conn->socket);
         }
-        file.close();
+        if (!session.userID.empty()) bank.executeSessionCommand(session, "logout");
+        {
+            lock_guard<mutex> lock(clientsMutex);
+            clients.erase(conn->socket);
+        }
+        closeSocket(conn->socket);
+    }
+
+    // Claims the connection for a pool task unless one is running it.
+    static bool claim(Connection& conn) {
+        if (conn.busy) return false;
+        conn.busy = true;
+        return true;
+    }
+
+    // Called by the poll loop once it stops watching the connection.
+    void hangUp(const shared_ptr<Connection>& conn, ThreadPool& pool) {
+        lock_guard<mutex> lock(conn->inputMutex);
+        conn->hungUp = true;
+        if (claim(*conn)) pool.submit([this, conn] { runCommands(conn); });
     }
 
-    void saveUsers() {
-        ofstream file(USERS_FILE);
-        for (User* user : users) {
-            file << user->getUserID() << "|" << user->getName() << "|" << user->getContact() << "|" << user->getPassword() << "|" << user->getRole();
-            if (user->getRole() == "Donor") {
-                Donor* donor = dynamic_cast<Donor*>(user);
-                if (donor) {
-                    file << "|" << donor->getBloodType();
+    // Appends input and hands the connection to the pool when it has a
+    // complete line. Returns false when the connection should be dropped.
+    bool receive(const shared_ptr<Connection>& conn, ThreadPool& pool) {
+        char buffer[4096];
+        int received = int(recv(conn->socket, buffer, sizeof(buffer), 0));
+        if (received <= 0) return false;
+        lock_guard<mutex> lock(conn->inputMutex);
+        conn->pending.append(buffer, size_t(received));
+        if (conn->pending.find('\n') == string::npos) return conn->pending.size() <= MAX_LINE;
+        if (claim(*conn)) pool.submit([this, conn] { runCommands(conn); });
+        return true;
+    }
+
+    void acceptClient(map<SocketHandle, shared_ptr<Connection>>& connections) {
+        SocketHandle client = ::accept(listener, nullptr, nullptr);
+        if (client == NO_SOCKET) return;
+        if (stopping || !sendAll(client, "OK Blood Bank server ready. Type help for commands.\n")) {
+            closeSocket(client);
+            return;
+        }
+        lock_guard<mutex> lock(clientsMutex);
+        clients.insert(client);
+        connections.emplace(client, make_shared<Connection>(client));
+    }
+
+    int listenAndServe() {
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        if (listener == NO_SOCKET) {
+            cout << "Could not create server socket.\n";
+            return 1;
+        }
+        int reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+        sockaddr_in addr = loopbackAddress(port);
+        if (::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listener, SOMAXCONN) != 0) {
+            cout << "Could not listen on 127.0.0.1:" << port << ".\n";
+            closeSocket(listener);
+            return 1;
+        }
+        cout << "Serving on 127.0.0.1:" << port << " with " << workerCount << " worker threads.\n";
+        bank.getCore().log("Server started on port " + to_string(port));
+        {
+            // Declared first so queued commands finish before the
+            // connections go.
+            ThreadPool pool(workerCount);
+            map<SocketHandle, shared_ptr<Connection>> connections;
+            vector<pollfd> fds;
+            while (!stopping) {
+                fds.clear();
+                fds.push_back({listener, POLLIN, 0});
+                for (const auto& entry : connections) {
+                    lock_guard<mutex> lock(entry.second->inputMutex);
+                    if (!entry.second->busy || entry.second->pending.size() <= MAX_LINE) fds.push_back({entry.first, POLLIN, 0});
+                }
+                if (pollSockets(fds, POLL_INTERVAL_MS) <= 0) continue;
+                for (size_t i = 1; i < fds.size(); ++i) {
+                    if (!fds[i].revents) continue;
+                    auto it = connections.find(fds[i].fd);
+                    if (receive(it->second, pool)) continue;
+                    hangUp(it->second, pool);
+                    connections.erase(it);
                 }
+                if (fds[0].revents) acceptClient(connections);
             }
-            file << endl;
+            for (const auto& entry : connections) hangUp(entry.second, pool);
         }
-        file.close();
+        closeSocket(listener);
+        bank.getCore().log("Server stopped.");
+        cout << "Server stopped.\n";
+        return 0;
     }
-        void loadBloodInventory() {
-    ifstream file(BLOOD_FILE);
-    if (!file.is_open()) return;
-    string line;
-    while (getline(file, line)) {
-        vector<string> tokens = Utility::split(line, '|');
-        if (tokens.size() != 4) continue; 
-        string bloodType = tokens[0];
-        int qty = stoi(tokens[1]);
-        string date = tokens[2];
-        string donorName = tokens[3];
-        bloodInventory.emplace_back(bloodType, qty, date, donorName);
-    }
-    file.close();
-}
 
-    void saveBloodInventory() {
-    ofstream file(BLOOD_FILE);
-    for (const BloodUnit& unit : bloodInventory) {
-        file << unit.getBloodType() << "|" << unit.getQuantity() << "|" << unit.getDonationDate()
-             << "|" << unit.getDonorName() << "\n"; 
+public:
+    BankServer(BloodBankSystem& bank, uint16_t port, size_t workerCount)
+        : bank(bank), port(port), workerCount(workerCount) {}
+
+    int run() {
+#ifdef _WIN32
+        WSADATA wsa;
+        if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+            cout << "Winsock startup failed.\n";
+            return 1;
+        }
+#endif
+        int exitCode = listenAndServe();
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return exitCode;
     }
-    file.close();
-}
 
-    void loadBloodRequests() {
-        ifstream file(REQUESTS_FILE);
-        if (!file.is_open()) return;
+    // Ends every session and wakes the accept loop with a dummy connection.
+    void stop() {
+        if (stopping.exchange(true)) return;
+        {
+            lock_guard<mutex> lock(clientsMutex);
+            for (SocketHandle client : clients) shutdownSocket(client);
+        }
+        SocketHandle wake = socket(AF_INET, SOCK_STREAM, 0);
+        if (wake == NO_SOCKET) return;
+        sockaddr_in addr = loopbackAddress(port);
+        connect(wake, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        closeSocket(wake);
+    }
+};
+
+
+// Compares the original getline/istringstream/stoi line parser with the
+// string_view tokenizer on a generated inventory file.
+class TokenizerBenchmark {
+    static vector<string> legacySplit(const string& s, char delimiter) {
+        vector<string> tokens;
+        string token;
+        istringstream tokenStream(s);
+        while (getline(tokenStream, token, delimiter)) {
+            tokens.push_back(token);
+        }
+        return tokens;
+    }
+
+    static void generate(const string& path, size_t rows) {
+        ofstream file(path);
+        for (size_t i = 0; i < rows; ++i) {
+            file << VALID_BLOOD_TYPES[i % BLOOD_TYPE_COUNT] << "|" << (250 + i % 300) << "|2025-"
+                 << (i % 9 + 10) << "-" << (i % 18 + 10) << "|Donor Name " << (i % 5000) << "\n";
+        }
+    }
+
+    static double secondsSince(chrono::steady_clock::time_point start) {
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+public:
+    static void run(size_t rows) {
+        string path = (filesystem::temp_directory_path() / "bbm_tokenizer_bench.txt").string();
+        generate(path, rows);
+
+        auto start = chrono::steady_clock::now();
+        long long legacySum = 0;
+        ifstream file(path);
         string line;
         while (getline(file, line)) {
-            vector<string> tokens = Utility::split(line, '|');
-            if (tokens.size() != 6) continue;
-            string reqID = tokens[0];
-            string reqorID = tokens[1];
-            string bloodType = tokens[2];
-            int qty = stoi(tokens[3]);
-            string reqDate = tokens[4];
-            string status = tokens[5];
-            bloodRequests.emplace_back(reqID, reqorID, bloodType, qty, reqDate, status);
+            vector<string> tokens = legacySplit(line, '|');
+            if (tokens.size() == 4) legacySum += stoi(tokens[1]);
         }
         file.close();
+        double legacySeconds = secondsSince(start);
+
+        start = chrono::steady_clock::now();
+        long long viewSum = 0;
+        MappedFile::forEachLine(path, [&](string_view line) {
+            array<string_view, 4> tokens;
+            int qty;
+            if (Utility::splitView(line, '|', tokens) == 4 && Utility::parseInt(tokens[1], qty)) viewSum += qty;
+        });
+        double viewSeconds = secondsSince(start);
+
+        error_code ec;
+        filesystem::remove(path, ec);
+
+        cout << "Rows: " << rows << (legacySum == viewSum ? "" : " (checksum mismatch!)") << "\n";
+        cout << "split + stoi:            " << size_t(rows / legacySeconds) << " lines/s\n";
+        cout << "splitView + from_chars:  " << size_t(rows / viewSeconds) << " lines/s\n";
+        cout << "Speedup: " << legacySeconds / viewSeconds << "x\n";
     }
+};
 
-    void saveBloodRequests() {
-        ofstream file(REQUESTS_FILE);
-        for (const BloodRequest& req : bloodRequests) {
-            file << req.getRequestID() << "|" << req.getRequestorID() << "|" << req.getBloodType() << "|"
-                 << req.getQuantity() << "|" << req.getRequestDate() << "|" << req.getStatus() << "\n";
+
+// End-to-end benchmark over a synthetic dataset. Writes users, inventory
+// and requests at the given scale into a scratch directory, then times the
+// hot paths there. Each result is one JSON line so runs can be diffed
+// between versions.
+class BankBenchmark {
+    static constexpr size_t LOGIN_OPS = 100000;
+    static constexpr size_t APPROVE_OPS = 1000;
+    static constexpr size_t SUMMARY_OPS = 5;
+    // Several times the logger's queue, so producers hit a full queue.
+    static constexpr size_t LOG_BURST_OPS = 20000;
+    // A burst that stalls on the writer's flush timer takes seconds.
+    static constexpr double LOG_BURST_LIMIT_US = 1000000;
+    // Marks a directory as the benchmark's own. generate() deletes the
+    // bank's files, so any other non-empty directory is refused.
+    static constexpr const char* MARKER_FILE = ".bbm_bench";
+
+    // Spreads consecutive i over [0, n) so lookups don't walk memory in order.
+    static size_t scatter(size_t i, size_t n) {
+        return size_t((uint64_t(i) * 2654435761u) % n);
+    }
+
+    static string dateFor(size_t i) {
+        char buf[11];
+        snprintf(buf, sizeof(buf), "2025-%02d-%02d", int(i % 12 + 1), int(i / 12 % 28 + 1));
+        return buf;
+    }
+
+    // Donation dates within the shelf life, so all stock is usable.
+    static string unitDateFor(size_t i) {
+        return Utility::fromDayNumber(Utility::today() - int32_t(i % SHELF_LIFE_DAYS));
+    }
+
+    static void writeRows(const string& path, size_t rows, const function<void(size_t, string&)>& row) {
+        ofstream file(path, ios::binary);
+        string buffer;
+        for (size_t i = 0; i < rows; ++i) {
+            row(i, buffer);
+            if (buffer.size() >= LOG_WRITE_BUFFER) {
+                file.write(buffer.data(), streamsize(buffer.size()));
+                buffer.clear();
+            }
         }
-        file.close();
+        file.write(buffer.data(), streamsize(buffer.size()));
     }
 
-    void saveRequestIDCounter() {
-        ofstream file(REQUEST_ID_FILE);
-        file << requestIDCounter;
-        file.close();
+    // One in 20 users is an admin, 12 in 20 donors, the rest requestors.
+    // Every unit and request is 450 ml so each approval draws exactly one unit.
+    static void generate(size_t rows) {
+        error_code ec;
+        for (const string& path : {USERS_FILE, BLOOD_FILE, REQUESTS_FILE, REQUEST_ID_FILE, BLOOD_JOURNAL_FILE,
+                                   REQUESTS_JOURNAL_FILE, USERS_SNAPSHOT_FILE, BLOOD_SNAPSHOT_FILE, REQUESTS_SNAPSHOT_FILE,
+                                   REQUESTS_ARCHIVE_FILE, REQUESTS_ARCHIVE_SUMMARY_FILE}) {
+            filesystem::remove(path, ec);
+        }
+        writeRows(USERS_FILE, rows, [](size_t i, string& out) {
+            string id = to_string(i);
+            size_t kind = i % 20;
+            out += "U" + id + "|User " + id + "|555" + id + "|pw" + id + "|";
+            if (kind == 0) out += "Admin\n";
+            else if (kind <= 12) out += "Donor|" + VALID_BLOOD_TYPES[i % BLOOD_TYPE_COUNT] + "\n";
+            else out += "Requestor\n";
+        });
+        writeRows(BLOOD_FILE, rows, [](size_t i, string& out) {
+            out += VALID_BLOOD_TYPES[i % BLOOD_TYPE_COUNT] + "|450|" + unitDateFor(i) + "|User " + to_string(i / 20 * 20 + 1)
+                 + "|" + to_string(i + 1) + "\n";
+        });
+        writeRows(REQUESTS_FILE, rows, [](size_t i, string& out) {
+            out += "REQ" + to_string(1000 + i) + "|U" + to_string(i / 20 * 20 + 13) + "|"
+                 + VALID_BLOOD_TYPES[scatter(i, BLOOD_TYPE_COUNT)] + "|450|" + dateFor(i) + "|Pending\n";
+        });
+        ofstream(REQUEST_ID_FILE) << 1000 + rows;
     }
 
-    void saveAllData() {
-        saveUsers();
-        saveBloodInventory();
-        saveBloodRequests();
-        saveRequestIDCounter();
+    static double microsSince(chrono::steady_clock::time_point start) {
+        return chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
     }
 
-    void loadRequestIDCounter() {
-        ifstream file(REQUEST_ID_FILE);
-        if (file.is_open()) {
-            file >> requestIDCounter;
-            file.close();
+    static void report(const string& name, size_t rows, vector<double> samples) {
+        sort(samples.begin(), samples.end());
+        double total = 0;
+        for (double s : samples) total += s;
+        auto percentile = [&](double p) { return samples[min(samples.size() - 1, size_t(p * samples.size()))]; };
+        char buf[256];
+        snprintf(buf, sizeof(buf),
+                 "{\"bench\":\"%s\",\"rows\":%zu,\"ops\":%zu,\"mean_us\":%.3f,\"p50_us\":%.3f,\"p99_us\":%.3f,\"max_us\":%.3f}",
+                 name.c_str(), rows, samples.size(), total / samples.size(), percentile(0.5), percentile(0.99), samples.back());
+        cout << buf << endl;
+    }
+
+    static void timeEach(const string& name, size_t rows, size_t ops, const function<void(size_t)>& op) {
+        vector<double> samples;
+        samples.reserve(ops);
+        for (size_t i = 0; i < ops; ++i) {
+            auto start = chrono::steady_clock::now();
+            op(i);
+            samples.push_back(microsSince(start));
+        }
+        report(name, rows, move(samples));
+    }
+
+public:
+    // Runs inside dir, which only ever holds benchmark data.
+    static int run(size_t rows, const string& dir) {
+        if (rows == 0) return 1;
+        error_code ec;
+        if (filesystem::exists(dir, ec) && !filesystem::is_empty(dir, ec)
+            && !filesystem::exists(filesystem::path(dir) / MARKER_FILE, ec)) {
+            cerr << "Refusing to use benchmark directory " << dir
+                 << ": it is not empty and was not created by --bench.\n";
+            return 1;
         }
+        filesystem::create_directories(dir, ec);
+        filesystem::current_path(dir, ec);
+        if (ec) {
+            cerr << "Cannot use benchmark directory " << dir << ": " << ec.message() << "\n";
+            return 1;
+        }
+        ofstream(MARKER_FILE).close();
+
+        auto start = chrono::steady_clock::now();
+        generate(rows);
+        report("generate", rows, {microsSince(start)});
+
+        start = chrono::steady_clock::now();
+        unique_ptr<BloodBankCore> core(new BloodBankCore());
+        report("startup_load", rows, {microsSince(start)});
+
+        size_t hits = 0;
+        timeEach("login_lookup", rows, min(rows, LOGIN_OPS), [&](size_t i) {
+            string id = to_string(scatter(i, rows));
+            User user;
+            if (core->authenticateUser("U" + id, "pw" + id, user)) hits++;
+        });
+
+        size_t approved = 0;
+        timeEach("approve_request", rows, min(rows, APPROVE_OPS), [&](size_t i) {
+            string reqID = "REQ" + to_string(1000 + scatter(i, rows));
+            if (core->approve(reqID) == OperationResult::Ok) approved++;
+        });
+
+        timeEach("inventory_summary", rows, SUMMARY_OPS, [&](size_t) { core->formatInventorySummary(); });
+        timeEach("user_summary", rows, SUMMARY_OPS, [&](size_t) { core->formatUserSummary(); });
+        timeEach("requests_summary", rows, SUMMARY_OPS, [&](size_t) { core->formatRequestsSummary(); });
+
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < LOG_BURST_OPS; ++i) core->log("Benchmark log burst " + to_string(i));
+        double burstMicros = microsSince(start);
+        report("log_burst", LOG_BURST_OPS, {burstMicros});
+
+        start = chrono::steady_clock::now();
+        core->saveAllData();
+        report("save_all", rows, {microsSince(start)});
+
+        core.reset();
+        if (hits != min(rows, LOGIN_OPS) || approved == 0) {
+            cerr << "Benchmark sanity check failed: " << hits << " logins, " << approved << " approvals.\n";
+            return 1;
+        }
+        if (burstMicros > LOG_BURST_LIMIT_US) {
+            cerr << "Benchmark sanity check failed: " << LOG_BURST_OPS << " log messages took "
+                 << size_t(burstMicros / 1000) << " ms; producers stalled on a full log queue.\n";
+            return 1;
+        }
+        return 0;
     }
 };
 
-BloodBankSystem* BloodBankSystem::instance = nullptr;
 
-int main() {
+// Reads the optional positive numeric argument at argv[index], no larger
+// than maxValue; fallback when it is absent.
+static bool parseArgument(int argc, char* argv[], int index, int fallback, int maxValue, int& value) {
+    if (argc <= index) {
+        value = fallback;
+        return true;
+    }
+    return Utility::parseInt(argv[index], value) && value > 0 && value <= maxValue;
+}
+
+const char* const USAGE =
+    "Usage: BloodBankManagement [--batch <file> | --serve [port] [workers] | --bench [rows] [dir]\n"
+    "                            | --bench-tokenizer [count] | --to-binary | --to-text]\n";
+
+int main(int argc, char* argv[]) {
+    string mode = argc > 1 ? argv[1] : "";
+    int count = 0;
+    if (mode == "--bench-tokenizer") {
+        if (!parseArgument(argc, argv, 2, 1000000, INT32_MAX, count)) {
+            cerr << USAGE;
+            return 2;
+        }
+        TokenizerBenchmark::run(size_t(count));
+        return 0;
+    }
+    if (mode == "--bench") {
+        if (!parseArgument(argc, argv, 2, 100000, INT32_MAX, count)) {
+            cerr << USAGE;
+            return 2;
+        }
+        string dir = argc > 3 ? argv[3] : (filesystem::temp_directory_path() / "bbm_bench").string();
+        return BankBenchmark::run(size_t(count), dir);
+    }
+    int port = 0, workers = 0;
+    if (mode == "--serve" && (!parseArgument(argc, argv, 2, DEFAULT_SERVER_PORT, UINT16_MAX, port)
+                              || !parseArgument(argc, argv, 3, int(DEFAULT_SERVER_WORKERS), 1024, workers))) {
+        cerr << USAGE;
+        return 2;
+    }
     BloodBankSystem* system = BloodBankSystem::getInstance();
-    system->run();
-    return 0;
-}
\ No newline at end of file
+    int exitCode = 0;
+    if (mode == "--batch" && argc > 2) {
+        exitCode = system->runBatch(argv[2]) == 0 ? 0 : 1;
+    } else if (mode == "--serve") {
+        exitCode = BankServer(*system, uint16_t(port), size_t(workers)).run();
+    } else if (mode == "--to-binary" || mode == "--to-text") {
+        system->getCore().setBinarySnapshots(mode == "--to-binary");
+        cout << "Snapshots converted to " << (mode == "--to-binary" ? "binary" : "text") << " format.\n";
+    } else {
+        system->run();
+    }
+    BloodBankSystem::destroyInstance();
+    return exitCode;
+}